@@ -97,6 +97,23 @@ delay_sec (uint32_t sec)
     }
 }
 
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * delay_cycles() - delay n CPU cycles
+ *
+ * Uses the DWT cycle counter instead of SysTick, so it can be called from interrupt handlers, too.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+delay_cycles (uint32_t cycles)
+{
+    uint32_t    start = DWT->CYCCNT;
+
+    while ((uint32_t) (DWT->CYCCNT - start) < cycles)
+    {
+        ;
+    }
+}
+
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * delay_init() - init delay functions
  *-------------------------------------------------------------------------------------------------------------------------------------------
@@ -116,4 +133,8 @@ delay_init (uint_fast8_t res)
 
     SysTick_Config (SystemCoreClock / divider);
     resolution = res;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;                             // enable DWT cycle counter for delay_cycles()
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 }
@@ -43,11 +43,14 @@
 
 #define DELAY_DEFAULT_RESOLUTION        DELAY_RESOLUTION_100_US
 
+#define DELAY_USEC_TO_CYCLES(usec)      ((usec) * (SystemCoreClock / 1000000))  // convert usec into CPU cycles for delay_cycles()
+
 extern volatile uint32_t                delay_counter;              // counts down in units of resolution
 
 extern void delay_usec (uint32_t);                                  // delay of n usec, only reasonable if resolution is 1us or 5us
 extern void delay_msec (uint32_t);                                  // delay of n msec
 extern void delay_sec  (uint32_t);                                  // delay of n sec
+extern void delay_cycles (uint32_t);                                // delay of n CPU cycles, can be used in ISRs
 extern void delay_init (uint_fast8_t);                              // init delay functions
 
 #endif
@@ -0,0 +1,367 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap-combo.c - combos: keys pressed together within a time window give another PS/2 key
+ *
+ * A combo is a set of keys pressed within a time window, e.g. Q+W within 30 msec = ESC. The stage sits between
+ * the key event queue and the keymap:
+ *
+ *   - events of keys which are not part of any combo pass at once, with no added latency
+ *   - presses of combo keys are held back in a small buffer as long as a combo may still complete
+ *   - the combo fires when all its keys are held, the last press not later than the window after the first one.
+ *     Its PS/2 key is made instead of the keys, and broken on release of the first of them. The other releases
+ *     are dropped. While held, the combo repeats like a key, see keymap_combo_held().
+ *   - held presses are sent unchanged, in order, if no combo can complete anymore, if one of them is released,
+ *     or if the window has elapsed
+ *
+ * The window is measured with the frame timestamps of the events. The time events are held back is measured with
+ * the DWT cycle counter, from arrival in the stage to leaving it, see keymap_combo_get_stats().
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdint.h>
+
+#include "stm32f10x_conf.h"
+#include "stm32f10x.h"
+
+#include "zxkbd.h"
+#include "zxkbd-events.h"
+#include "ps2kbd.h"
+#include "keymap-combo.h"
+
+#define OUT_LEN                 8                                               // power of two, > KEYMAP_COMBO_BUFFER + 1
+#define OUT_MASK                (OUT_LEN - 1)
+
+typedef struct
+{
+    zxkbd_bitmap_t              keys;                                           // keys to be pressed together
+    uint16_t                    window_usec;                                    // max. time between first and last press
+    uint8_t                     ps2key;                                         // PS/2 key sent instead
+} keymap_combo_t;
+
+#if KEYMAP_COMBOS == 1
+static const keymap_combo_t combos[] =
+{
+    { ZXKBD_KEY_BIT(ZXKBD_KEY_INDEX(2, 0)) | ZXKBD_KEY_BIT(ZXKBD_KEY_INDEX(2, 1)),  30000,  PS2KBD_KEY_ESC },   // Q + W
+};
+
+#define COMBOS                  (sizeof (combos) / sizeof (combos[0]))
+
+static zxkbd_bitmap_t       combo_keys;                                         // keys of all combos
+static zxkbd_bitmap_t       combo_fired[COMBOS];                                // keys of fired combo still held
+static zxkbd_bitmap_t       combo_swallowed;                                    // releases to drop, all combo_fired[]
+
+static zxkbd_event_t        combo_buf[KEYMAP_COMBO_BUFFER];                     // presses held back
+static uint32_t             combo_buf_cycles[KEYMAP_COMBO_BUFFER];              // DWT->CYCCNT at arrival of held presses
+static uint_fast8_t         combo_buf_len;
+static zxkbd_bitmap_t       combo_buf_keys;                                     // keys of held presses
+static uint32_t             combo_hold_usec;                                    // max. window of combos still possible
+#endif
+
+static zxkbd_event_t        combo_out[OUT_LEN];                                 // events leaving the stage
+static uint8_t              combo_out_ps2key[OUT_LEN];                          // PS/2 key of combo, PS2KBD_KEY_NONE = key event
+static uint_fast8_t         combo_out_head;
+static uint_fast8_t         combo_out_tail;
+
+static keymap_combo_stats_t combo_stats;
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_combo_init () - initialize combo stage
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+keymap_combo_init (void)
+{
+#if KEYMAP_COMBOS == 1
+    uint_fast8_t    i;
+
+    combo_keys      = 0;
+    combo_swallowed = 0;
+
+    for (i = 0; i < COMBOS; i++)
+    {
+        combo_keys |= combos[i].keys;
+        combo_fired[i] = 0;
+    }
+
+    combo_buf_len   = 0;
+    combo_buf_keys  = 0;
+#endif
+    combo_out_head  = 0;
+    combo_out_tail  = 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_combo_out () - pass event to next stage, ps2key != PS2KBD_KEY_NONE: combo key instead of event key
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+keymap_combo_out (const zxkbd_event_t * evp, uint_fast8_t ps2key)
+{
+    combo_out[combo_out_head]           = *evp;
+    combo_out_ps2key[combo_out_head]    = ps2key;
+    combo_out_head = (combo_out_head + 1) & OUT_MASK;
+}
+
+#if KEYMAP_COMBOS == 1
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_combo_hold_usec () - get max. window of combos which may still complete with keys held back
+ *
+ * Return value: window in usec, 0 = no combo possible
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint32_t
+keymap_combo_hold_usec (zxkbd_bitmap_t keys)
+{
+    uint32_t        usec = 0;
+    uint_fast8_t    i;
+
+    for (i = 0; i < COMBOS; i++)
+    {
+        if (! combo_fired[i] && ! (keys & ~combos[i].keys) && combos[i].window_usec > usec)
+        {
+            usec = combos[i].window_usec;
+        }
+    }
+
+    return usec;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_combo_flush () - send presses held back unchanged, count their added latency
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+keymap_combo_flush (void)
+{
+    uint32_t        now = DWT->CYCCNT;
+    uint32_t        usec;
+    uint_fast8_t    i;
+
+    for (i = 0; i < combo_buf_len; i++)
+    {
+        keymap_combo_out (&combo_buf[i], PS2KBD_KEY_NONE);
+
+        usec = (now - combo_buf_cycles[i]) / (SystemCoreClock / 1000000);
+        combo_stats.sum_usec += usec;
+
+        if (usec > combo_stats.max_usec)
+        {
+            combo_stats.max_usec = usec;
+        }
+    }
+
+    combo_stats.held += combo_buf_len;
+    combo_buf_len   = 0;
+    combo_buf_keys  = 0;
+}
+#endif
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_combo_put () - feed key event into combo stage, fetch results by keymap_combo_get()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+keymap_combo_put (const zxkbd_event_t * evp)
+{
+#if KEYMAP_COMBOS == 1
+    zxkbd_bitmap_t  bit = ZXKBD_KEY_BIT(evp->key);
+    uint32_t        hold_usec;
+    uint_fast8_t    i;
+
+    combo_stats.events++;
+
+    if (evp->state == ZXKBD_KEY_PRESSED && (combo_keys & bit))
+    {
+        if (combo_buf_len == KEYMAP_COMBO_BUFFER ||
+            (combo_buf_len && evp->usec - combo_buf[0].usec > combo_hold_usec) ||
+            ! keymap_combo_hold_usec (combo_buf_keys | bit))
+        {
+            keymap_combo_flush ();                                              // no combo with held keys anymore, maybe with new one
+        }
+
+        hold_usec = keymap_combo_hold_usec (combo_buf_keys | bit);
+
+        if (! hold_usec)                                                        // all combos of key already fired
+        {
+            keymap_combo_out (evp, PS2KBD_KEY_NONE);
+            return;
+        }
+
+        combo_buf_cycles[combo_buf_len] = DWT->CYCCNT;
+        combo_buf[combo_buf_len++] = *evp;
+        combo_buf_keys |= bit;
+        combo_hold_usec = hold_usec;
+
+        for (i = 0; i < COMBOS; i++)
+        {
+            if (! combo_fired[i] && combo_buf_keys == combos[i].keys &&
+                evp->usec - combo_buf[0].usec <= combos[i].window_usec)
+            {
+                keymap_combo_out (evp, combos[i].ps2key);                       // make of combo key
+                combo_fired[i]  = combo_buf_keys;
+                combo_swallowed |= combo_buf_keys;
+                combo_buf_len   = 0;
+                combo_buf_keys  = 0;
+                combo_stats.combos++;
+                break;
+            }
+        }
+    }
+    else if (evp->state == ZXKBD_KEY_RELEASED && (combo_swallowed & bit))
+    {
+        combo_swallowed &= ~bit;
+
+        for (i = 0; i < COMBOS; i++)
+        {
+            if (combo_fired[i] & bit)
+            {
+                if (combo_fired[i] == combos[i].keys)                           // first release: break of combo key
+                {
+                    keymap_combo_out (evp, combos[i].ps2key);
+                }
+
+                combo_fired[i] &= ~bit;
+                break;
+            }
+        }
+    }
+    else
+    {
+        keymap_combo_flush ();                                                  // keep order of events
+        keymap_combo_out (evp, PS2KBD_KEY_NONE);
+    }
+#else
+    combo_stats.events++;
+    keymap_combo_out (evp, PS2KBD_KEY_NONE);
+#endif
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_combo_get () - get next event leaving the combo stage
+ *
+ * evp:     key event, state is ZXKBD_KEY_PRESSED or ZXKBD_KEY_RELEASED
+ * ps2keyp: PS2KBD_KEY_NONE = send key of event as usual, else combo PS/2 key to be sent instead
+ *
+ * Return value: 1 = event returned, 0 = no event
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+keymap_combo_get (zxkbd_event_t * evp, uint_fast8_t * ps2keyp)
+{
+    if (combo_out_tail == combo_out_head)
+    {
+        return 0;
+    }
+
+    *evp        = combo_out[combo_out_tail];
+    *ps2keyp    = combo_out_ps2key[combo_out_tail];
+    combo_out_tail = (combo_out_tail + 1) & OUT_MASK;
+    return 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_combo_poll () - send presses held back if their window has elapsed
+ *
+ * Return value: time in usec until held presses expire, 0 = nothing held back
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint32_t
+keymap_combo_poll (void)
+{
+#if KEYMAP_COMBOS == 1
+    uint32_t        usec;
+
+    if (combo_buf_len)
+    {
+        usec = (DWT->CYCCNT - combo_buf_cycles[0]) / (SystemCoreClock / 1000000);
+
+        if (usec < combo_hold_usec)
+        {
+            return combo_hold_usec - usec;
+        }
+
+        keymap_combo_flush ();
+    }
+#endif
+    return 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_combo_held () - get keys of combos whose PS/2 key is held on host
+ *
+ * The keys of a combo are never passed on as key events, so callers add them to their own pressed keys, e.g.
+ * for the board LED and the typematic repeat.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+zxkbd_bitmap_t
+keymap_combo_held (void)
+{
+    zxkbd_bitmap_t  held = 0;
+#if KEYMAP_COMBOS == 1
+    uint_fast8_t    i;
+
+    for (i = 0; i < COMBOS; i++)
+    {
+        if (combo_fired[i] == combos[i].keys)                                   // no key of combo released yet
+        {
+            held |= combo_fired[i];
+        }
+    }
+#endif
+    return held;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_combo_ps2key () - get PS/2 key of held combo containing a key, to be repeated by typematic
+ *
+ * Return value: PS/2 key of combo, PS2KBD_KEY_NONE = key is not part of a held combo
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+keymap_combo_ps2key (uint_fast8_t key)
+{
+#if KEYMAP_COMBOS == 1
+    uint_fast8_t    i;
+
+    for (i = 0; i < COMBOS; i++)
+    {
+        if (combo_fired[i] == combos[i].keys && (combo_fired[i] & ZXKBD_KEY_BIT(key)))
+        {
+            return combos[i].ps2key;
+        }
+    }
+#else
+    (void) key;
+#endif
+    return PS2KBD_KEY_NONE;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_combo_get_stats () - get latency counters of combo stage
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+keymap_combo_get_stats (keymap_combo_stats_t * stats)
+{
+    *stats = combo_stats;
+}
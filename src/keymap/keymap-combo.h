@@ -0,0 +1,67 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap-combo.h - combos: keys pressed together within a time window give another PS/2 key
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef KEYMAP_COMBO_H
+#define KEYMAP_COMBO_H
+
+#include <stdint.h>
+#include "zxkbd.h"
+#include "zxkbd-events.h"
+
+/* 1 = combo detection enabled, 0 = all events pass at once */
+#ifndef KEYMAP_COMBOS
+#define KEYMAP_COMBOS           1
+#endif
+
+/* 1 = report added latency per UART after events were held back, for tuning of windows */
+#ifndef KEYMAP_COMBO_REPORT
+#define KEYMAP_COMBO_REPORT     0
+#endif
+
+#define KEYMAP_COMBO_BUFFER     4                                               // max. presses held back, max. keys of a combo
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * latency counters, see keymap_combo_get_stats()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    uint32_t            events;                                                 // events passed through stage
+    uint32_t            held;                                                   // events held back, then sent unchanged
+    uint32_t            combos;                                                 // combos detected
+    uint32_t            sum_usec;                                               // added latency of all held events
+    uint32_t            max_usec;                                               // max. added latency of a held event
+} keymap_combo_stats_t;
+
+extern void                     keymap_combo_init (void);
+extern void                     keymap_combo_put (const zxkbd_event_t * evp);
+extern uint_fast8_t             keymap_combo_get (zxkbd_event_t * evp, uint_fast8_t * ps2keyp);
+extern uint32_t                 keymap_combo_poll (void);
+extern zxkbd_bitmap_t           keymap_combo_held (void);
+extern uint_fast8_t             keymap_combo_ps2key (uint_fast8_t key);
+extern void                     keymap_combo_get_stats (keymap_combo_stats_t * stats);
+
+#endif
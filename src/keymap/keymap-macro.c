@@ -0,0 +1,267 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap-macro.c - macros: key sequences stored in flash, played back on trigger key
+ *
+ * A macro is a sequence of matrix key events, stored in flash and played back through the keymap, so layers apply
+ * as if the keys were typed. A macro is triggered when the set of held keys becomes equal to its trigger bitmap,
+ * e.g. CS+SS+L. The key completing the trigger is not sent to the host, neither make nor break. Playback starts
+ * when all keys of the trigger are released, so CAPS SHIFT and SYMBOL SHIFT of the trigger don't change the keys
+ * of the macro.
+ *
+ * Playback is paced: one event per KEYMAP_MACRO_PACE_USEC or per stored delay. The main loop polls the next
+ * event by keymap_macro_next(), so scanning and all other tasks keep running. Any key pressed before or during
+ * playback cancels the macro: all keys pressed by the macro and not yet released are released at once.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdint.h>
+
+#include "zxkbd.h"
+#include "keymap-macro.h"
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * Storage format of macro events, one or two bytes per event:
+ *
+ *     bit 7       0 = press, 1 = release
+ *     bit 6       1 = delay byte follows: time to next event in msec, instead of KEYMAP_MACRO_PACE_USEC
+ *     bit 0 - 5   key index minus key index of previous event, modulo 64, first event relative to 0
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define MACRO_RELEASE           0x80                                            // event flag: release
+#define MACRO_DELAY             0x40                                            // event flag: delay byte follows
+#define MACRO_DELTA_MASK        0x3F                                            // key index difference, modulo 64
+
+#define PRESS(k,prev)           (((k) - (prev)) & MACRO_DELTA_MASK)             // press key k, previous event was key prev
+#define RELEASE(k,prev)         (MACRO_RELEASE | PRESS(k,prev))                 // release key k, previous event was key prev
+
+#define KEY_J                   ZXKBD_KEY_INDEX(6, 3)
+#define KEY_L                   ZXKBD_KEY_INDEX(6, 1)
+#define KEY_P                   ZXKBD_KEY_INDEX(5, 0)
+#define KEY_ENTER               ZXKBD_KEY_INDEX(6, 0)
+#define KEY_CS                  ZXKBD_KEY_INDEX(0, 0)
+#define KEY_SS                  ZXKBD_KEY_INDEX(7, 1)
+
+#define TRIGGER_CS_SS(k)        (ZXKBD_KEY_BIT(KEY_CS) | ZXKBD_KEY_BIT(KEY_SS) | ZXKBD_KEY_BIT(k))  // trigger CS+SS+k
+
+typedef struct
+{
+    zxkbd_bitmap_t              trigger;                                        // keys to be held to start the macro
+    const uint8_t *             data;                                           // events, see storage format above
+    uint8_t                     len;                                            // number of bytes in data
+} keymap_macro_t;
+
+#if KEYMAP_MACROS == 1
+static const uint8_t        macro_load[] =                                      // LOAD "" ENTER
+{
+    PRESS(KEY_J, 0),            RELEASE(KEY_J, KEY_J),                          // J: LOAD in K mode
+    PRESS(KEY_SS, KEY_J),                                                       // SYMBOL SHIFT
+    PRESS(KEY_P, KEY_SS),       RELEASE(KEY_P, KEY_P),                          // "
+    PRESS(KEY_P, KEY_P),        RELEASE(KEY_P, KEY_P),                          // "
+    RELEASE(KEY_SS, KEY_P),
+    PRESS(KEY_ENTER, KEY_SS),   RELEASE(KEY_ENTER, KEY_ENTER)                   // ENTER
+};
+
+static const keymap_macro_t macros[] =
+{
+    { TRIGGER_CS_SS(KEY_L),         macro_load,     sizeof (macro_load) },      // CS+SS+L: LOAD ""
+};
+
+#define MACROS                  (sizeof (macros) / sizeof (macros[0]))
+
+static zxkbd_bitmap_t       macro_physical;                                     // keys held on keyboard
+static zxkbd_bitmap_t       macro_swallowed;                                    // trigger keys not sent to host
+static zxkbd_bitmap_t       macro_held;                                         // keys pressed by macro, not yet released
+static const keymap_macro_t * macro_current;                                    // macro being played, NULL = none
+static uint_fast8_t         macro_pos;                                          // next byte of macro_current->data
+static uint_fast8_t         macro_last_key;                                     // key index of previous event
+static uint_fast8_t         macro_cancelled;                                    // flag: release held keys and stop
+static uint_fast8_t         macro_waiting;                                      // flag: trigger still held, playback not started
+#endif
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_macro_init () - initialize macro playback, no macro playing
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+keymap_macro_init (void)
+{
+#if KEYMAP_MACROS == 1
+    macro_physical  = 0;
+    macro_swallowed = 0;
+    macro_held      = 0;
+    macro_current   = (const keymap_macro_t *) 0;
+    macro_cancelled = 0;
+    macro_waiting   = 0;
+#endif
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_macro_event () - check key event of keyboard for macro trigger, cancel macro on key press
+ *
+ * KEYMAP_MACRO_RUN is returned on the press cancelling a macro and on the release completing the release of the
+ * trigger. A cancelled macro has to release its keys before the press is sent, a triggered one is played after
+ * the release is sent.
+ *
+ * Return value: KEYMAP_MACRO_CONSUMED and/or KEYMAP_MACRO_RUN, 0 = send event as usual
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+keymap_macro_event (uint_fast8_t key, uint_fast8_t state)
+{
+#if KEYMAP_MACROS == 1
+    uint_fast8_t    flags = 0;
+    uint_fast8_t    i;
+
+    if (state == ZXKBD_KEY_PRESSED)
+    {
+        macro_physical |= ZXKBD_KEY_BIT(key);
+
+        if (macro_current)                                                      // key pressed during playback: cancel
+        {
+            macro_cancelled = 1;
+            flags = KEYMAP_MACRO_RUN;
+        }
+        else
+        {
+            for (i = 0; i < MACROS; i++)
+            {
+                if (macro_physical == macros[i].trigger)
+                {
+                    macro_current   = &macros[i];
+                    macro_pos       = 0;
+                    macro_last_key  = 0;
+                    macro_waiting   = 1;
+                    macro_swallowed |= ZXKBD_KEY_BIT(key);
+                    flags = KEYMAP_MACRO_CONSUMED;
+                    break;
+                }
+            }
+        }
+    }
+    else
+    {
+        macro_physical &= ~ZXKBD_KEY_BIT(key);
+
+        if (macro_swallowed & ZXKBD_KEY_BIT(key))
+        {
+            macro_swallowed &= ~ZXKBD_KEY_BIT(key);
+            flags = KEYMAP_MACRO_CONSUMED;
+        }
+
+        if (macro_waiting && ! (macro_physical & macro_current->trigger))       // trigger released: start playback
+        {
+            macro_waiting = 0;
+            flags |= KEYMAP_MACRO_RUN;
+        }
+    }
+
+    return flags;
+#else
+    (void) key;
+    (void) state;
+    return 0;
+#endif
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_macro_next () - get next event of macro being played
+ *
+ * keyp:    key index of event
+ * statep:  ZXKBD_KEY_PRESSED or ZXKBD_KEY_RELEASED
+ * usecp:   time until next event, 0 = next event is due at once
+ *
+ * Return value: 1 = event returned, 0 = playback finished, not yet started or no macro playing
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+keymap_macro_next (uint_fast8_t * keyp, uint_fast8_t * statep, uint32_t * usecp)
+{
+#if KEYMAP_MACROS == 1
+    uint_fast8_t    b;
+
+    if (! macro_current || (macro_waiting && ! macro_cancelled))
+    {
+        return 0;
+    }
+
+    if (macro_cancelled || macro_pos >= macro_current->len)                     // cancelled or finished: release keys still held
+    {
+        if (macro_held)
+        {
+            *keyp   = zxkbd_bitmap_next (&macro_held);
+            *statep = ZXKBD_KEY_RELEASED;
+            *usecp  = 0;
+            return 1;
+        }
+
+        macro_current   = (const keymap_macro_t *) 0;
+        macro_cancelled = 0;
+        macro_waiting   = 0;
+        return 0;
+    }
+
+    b = macro_current->data[macro_pos++];
+    macro_last_key = (macro_last_key + b) & MACRO_DELTA_MASK;
+    *keyp = macro_last_key;
+    *usecp = KEYMAP_MACRO_PACE_USEC;
+
+    if (b & MACRO_DELAY)
+    {
+        *usecp = 1000 * (uint32_t) macro_current->data[macro_pos++];
+    }
+
+    if (b & MACRO_RELEASE)
+    {
+        macro_held &= ~ZXKBD_KEY_BIT(macro_last_key);
+        *statep = ZXKBD_KEY_RELEASED;
+    }
+    else
+    {
+        macro_held |= ZXKBD_KEY_BIT(macro_last_key);
+        *statep = ZXKBD_KEY_PRESSED;
+    }
+
+    return 1;
+#else
+    (void) keyp;
+    (void) statep;
+    (void) usecp;
+    return 0;
+#endif
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_macro_playing () - check if macro is being played
+ *
+ * Return value: 1 = playing, 0 = idle
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+keymap_macro_playing (void)
+{
+#if KEYMAP_MACROS == 1
+    return macro_current != (const keymap_macro_t *) 0;
+#else
+    return 0;
+#endif
+}
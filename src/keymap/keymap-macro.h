@@ -0,0 +1,53 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap-macro.h - macros: key sequences stored in flash, played back on trigger key
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef KEYMAP_MACRO_H
+#define KEYMAP_MACRO_H
+
+#include <stdint.h>
+#include "zxkbd.h"
+
+/* 1 = macro playback enabled, 0 = trigger keys are normal keys */
+#ifndef KEYMAP_MACROS
+#define KEYMAP_MACROS           1
+#endif
+
+#ifndef KEYMAP_MACRO_PACE_USEC
+#define KEYMAP_MACRO_PACE_USEC  10000                                           // default time between two macro events
+#endif
+
+#define KEYMAP_MACRO_MAX_HELD   2                                               // max. keys held by a macro at a time, released on cancel
+
+/* return flags of keymap_macro_event() */
+#define KEYMAP_MACRO_CONSUMED   0x01                                            // event belongs to trigger, don't send it
+#define KEYMAP_MACRO_RUN        0x02                                            // playback started or cancelled, run playback now
+
+extern void                     keymap_macro_init (void);
+extern uint_fast8_t             keymap_macro_event (uint_fast8_t key, uint_fast8_t state);
+extern uint_fast8_t             keymap_macro_next (uint_fast8_t * keyp, uint_fast8_t * statep, uint32_t * usecp);
+extern uint_fast8_t             keymap_macro_playing (void);
+
+#endif
@@ -0,0 +1,314 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap.c - mapping of ZX keyboard matrix to PS/2 keys, CAPS SHIFT and SYMBOL SHIFT layers
+ *
+ * Each matrix position has a base PS/2 key. CAPS SHIFT and SYMBOL SHIFT are sent as LSHFT and LCTRL. While only one
+ * of them is held, a key may have an entry in the layer of that shift. The entry is the PC key of the ZX combination,
+ * e.g. CS+0 = Backspace, CS+5..8 = cursor keys, SS+P = '"'. Keys without an entry fall through to the base key,
+ * so CS+A still gives LSHFT + A.
+ *
+ * The symbols of the SYMBOL SHIFT layer are coded for a German host layout, like the PS/2 key names. The layer
+ * tables hold one byte per matrix position: the PS/2 key, bit 7 set if the key needs SHIFT on the host. 0 = no entry.
+ *
+ * Tricky cases:
+ *
+ *   - the physical shift (LSHFT/LCTRL) is released on the host while a layer key is held and pressed again after
+ *     the last layer key is released, so the host sees the PC key alone or with exactly the shift it needs
+ *   - the PS/2 key sent on press is stored per matrix position, so release sends the same break code, even if the
+ *     shift was released before the base key
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdint.h>
+
+#include "zxkbd.h"
+#include "ps2kbd.h"
+#include "keymap.h"
+
+#define KEYMAP_SHIFT            0x80                                            // layer entry flag: key needs SHIFT on host, PS2KBD_KEYS < 128
+#define S(k)                    (PS2KBD_KEY_##k | KEYMAP_SHIFT)                 // layer entry with SHIFT
+#define K(k)                    (PS2KBD_KEY_##k)                                // layer entry without SHIFT
+
+#define MOD_SHIFT               0x01                                            // LSHFT, sent for CAPS SHIFT
+#define MOD_CTRL                0x02                                            // LCTRL, sent for SYMBOL SHIFT
+
+static const uint8_t        keymap_base[ZX_KBD_ROWS][ZX_KBD_EXT_COLS] =
+{   //      D0                  D1                  D2              D3              D4              D5 (extra col)
+    {   PS2KBD_KEY_LSHFT,   PS2KBD_KEY_Z,       PS2KBD_KEY_X,   PS2KBD_KEY_C,   PS2KBD_KEY_V,   PS2KBD_KEY_TAB  },
+    {   PS2KBD_KEY_A,       PS2KBD_KEY_S,       PS2KBD_KEY_D,   PS2KBD_KEY_F,   PS2KBD_KEY_G,   PS2KBD_KEY_NONE },
+    {   PS2KBD_KEY_Q,       PS2KBD_KEY_W,       PS2KBD_KEY_E,   PS2KBD_KEY_R,   PS2KBD_KEY_T,   PS2KBD_KEY_NONE },
+    {   PS2KBD_KEY_1,       PS2KBD_KEY_2,       PS2KBD_KEY_3,   PS2KBD_KEY_4,   PS2KBD_KEY_5,   PS2KBD_KEY_NONE },
+    {   PS2KBD_KEY_0,       PS2KBD_KEY_9,       PS2KBD_KEY_8,   PS2KBD_KEY_7,   PS2KBD_KEY_6,   PS2KBD_KEY_NONE },
+    {   PS2KBD_KEY_P,       PS2KBD_KEY_O,       PS2KBD_KEY_I,   PS2KBD_KEY_U,   PS2KBD_KEY_Y,   PS2KBD_KEY_NONE },
+    {   PS2KBD_KEY_ENTER,   PS2KBD_KEY_L,       PS2KBD_KEY_K,   PS2KBD_KEY_J,   PS2KBD_KEY_H,   PS2KBD_KEY_NONE },
+    {   PS2KBD_KEY_SPACE,   PS2KBD_KEY_LCTRL,   PS2KBD_KEY_M,   PS2KBD_KEY_N,   PS2KBD_KEY_B,   PS2KBD_KEY_NONE },
+};
+
+#if KEYMAP_LAYERS == 1
+static const uint8_t        keymap_cs_layer[ZX_KBD_ROWS][ZX_KBD_EXT_COLS] =
+{   //  D0          D1          D2          D3          D4          D5
+    {   0,          0,          0,          0,          0,          0           },  // CS    Z     X     C     V
+    {   0,          0,          0,          0,          0,          0           },  // A     S     D     F     G
+    {   0,          0,          0,          0,          0,          0           },  // Q     W     E     R     T
+    {   0,          K(CAPS),    0,          0,          K(L_ARROW), 0           },  // 1     2     3     4     5
+    {   K(BSP),     0,          K(R_ARROW), K(U_ARROW), K(D_ARROW), 0           },  // 0     9     8     7     6
+    {   0,          0,          0,          0,          0,          0           },  // P     O     I     U     Y
+    {   0,          0,          0,          0,          0,          0           },  // ENTER L     K     J     H
+    {   K(ESC),     0,          0,          0,          0,          0           },  // SPACE SS    M     N     B
+};
+
+static const uint8_t        keymap_ss_layer[ZX_KBD_ROWS][ZX_KBD_EXT_COLS] =
+{   //  D0          D1          D2          D3          D4          D5
+    {   0,          S(DOT),     0,          S(SHARP_S), S(7),       0           },  // CS    :     £     ?     /
+    {   0,          0,          0,          0,          0,          0           },  // A     S     D     F     G
+    {   0,          0,          0,          K(LESS),    S(LESS),    0           },  // Q     W     E     <     >
+    {   S(1),       0,          K(HASH),    S(4),       S(5),       0           },  // !     @     #     $     %
+    {   S(MINUS),   S(9),       S(8),       S(HASH),    S(6),       0           },  // _     )     (     '     &
+    {   S(2),       S(COMMA),   0,          0,          0,          0           },  // "     ;     I     U     Y
+    {   0,          S(0),       K(PLUS),    K(MINUS),   0,          0           },  // ENTER =     +     -     H
+    {   0,          0,          K(DOT),     K(COMMA),   S(PLUS),    0           },  // SPACE SS    .     ,     *
+};
+
+static uint8_t              keymap_sent[ZXKBD_KEYS];                            // PS/2 key sent on press, per matrix position
+static zxkbd_bitmap_t       keymap_layered;                                     // held keys sent from a layer
+static uint_fast8_t         keymap_held;                                        // MOD_xxx: CS/SS physically held
+static uint_fast8_t         keymap_mods;                                        // MOD_xxx: LSHFT/LCTRL sent as pressed
+#endif
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_init () - initialize keymap state, no key held
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+keymap_init (void)
+{
+#if KEYMAP_LAYERS == 1
+    uint_fast8_t    key;
+
+    for (key = 0; key < ZXKBD_KEYS; key++)
+    {
+        keymap_sent[key] = PS2KBD_KEY_NONE;
+    }
+
+    keymap_layered  = 0;
+    keymap_held     = 0;
+    keymap_mods     = 0;
+#endif
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_ps2key () - get base PS/2 key of matrix position
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+keymap_ps2key (uint_fast8_t key)
+{
+    return keymap_base[ZXKBD_KEY_ROW(key)][ZXKBD_KEY_COL(key)];
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_modifiers () - get bitmap of matrix positions mapped to modifier keys
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+zxkbd_bitmap_t
+keymap_modifiers (void)
+{
+    zxkbd_bitmap_t  modifiers = 0;
+    uint_fast8_t    row;
+    uint_fast8_t    col;
+
+    for (row = 0; row < ZX_KBD_ROWS; row++)
+    {
+        for (col = 0; col < ZX_KBD_EXT_COLS; col++)
+        {
+            switch (keymap_base[row][col])
+            {
+                case PS2KBD_KEY_LSHFT:
+                case PS2KBD_KEY_RSHFT:
+                case PS2KBD_KEY_LCTRL:
+                case PS2KBD_KEY_RCTRL:
+                case PS2KBD_KEY_LALT:
+                case PS2KBD_KEY_RALT:
+                case PS2KBD_KEY_LWIN:
+                case PS2KBD_KEY_RWIN:
+                {
+                    modifiers |= ZXKBD_KEY_BIT(ZXKBD_KEY_INDEX(row, col));
+                    break;
+                }
+            }
+        }
+    }
+
+    return modifiers;
+}
+
+#if KEYMAP_LAYERS == 1
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_set_mods () - add actions to bring LSHFT/LCTRL on host into the wanted state
+ *
+ * Breaks are added before makes, so the host never sees both shifts at once.
+ *
+ * Return value: number of actions added
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+keymap_set_mods (uint_fast8_t wanted, keymap_action_t * actions)
+{
+    static const uint8_t    mod_keys[2] = { PS2KBD_KEY_LSHFT, PS2KBD_KEY_LCTRL };   // bit 0 = MOD_SHIFT, bit 1 = MOD_CTRL
+    uint_fast8_t            changes[2];
+    uint_fast8_t            released;
+    uint_fast8_t            i;
+    uint_fast8_t            n = 0;
+
+    changes[0] = wanted & ~keymap_mods;                                         // makes
+    changes[1] = keymap_mods & ~wanted;                                         // breaks
+
+    for (released = 2; released-- > 0; )                                        // first breaks, then makes
+    {
+        for (i = 0; i < 2; i++)
+        {
+            if (changes[released] & (1 << i))
+            {
+                actions[n].ps2key   = mod_keys[i];
+                actions[n].released = released;
+                n++;
+            }
+        }
+    }
+
+    keymap_mods = wanted;
+    return n;
+}
+#endif
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_event () - translate a key event of the matrix into PS/2 key events
+ *
+ * key:     key index of matrix position
+ * state:   ZXKBD_KEY_PRESSED or ZXKBD_KEY_RELEASED
+ * actions: buffer for KEYMAP_MAX_ACTIONS PS/2 key events, to be sent in this order
+ *
+ * Return value: number of PS/2 key events, one lookup per event
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+keymap_event (uint_fast8_t key, uint_fast8_t state, keymap_action_t * actions)
+{
+#if KEYMAP_LAYERS == 1
+    uint_fast8_t    row = ZXKBD_KEY_ROW(key);
+    uint_fast8_t    col = ZXKBD_KEY_COL(key);
+    uint_fast8_t    mod = 0;
+    uint_fast8_t    entry = 0;
+    uint_fast8_t    n = 0;
+
+    if (key == KEYMAP_KEY_CS)
+    {
+        mod = MOD_SHIFT;
+    }
+    else if (key == KEYMAP_KEY_SS)
+    {
+        mod = MOD_CTRL;
+    }
+
+    if (mod)                                                                    // CAPS SHIFT or SYMBOL SHIFT
+    {
+        if (state == ZXKBD_KEY_PRESSED)
+        {
+            keymap_held |= mod;
+        }
+        else
+        {
+            keymap_held &= ~mod;
+        }
+
+        if (! keymap_layered)                                                   // layer key held: host shift follows on its release
+        {
+            n = keymap_set_mods (keymap_held, actions);
+        }
+    }
+    else if (state == ZXKBD_KEY_PRESSED)
+    {
+        if (keymap_held == MOD_SHIFT)
+        {
+            entry = keymap_cs_layer[row][col];
+        }
+        else if (keymap_held == MOD_CTRL)
+        {
+            entry = keymap_ss_layer[row][col];
+        }
+
+        if (entry)                                                              // layer key: shift on host as needed by entry
+        {
+            n = keymap_set_mods ((entry & KEYMAP_SHIFT) ? MOD_SHIFT : 0, actions);
+            keymap_layered |= ZXKBD_KEY_BIT(key);
+            entry &= ~KEYMAP_SHIFT;
+        }
+        else
+        {
+            entry = keymap_base[row][col];
+        }
+
+        keymap_sent[key]        = entry;
+        actions[n].ps2key       = entry;
+        actions[n].released     = 0;
+        n++;
+    }
+    else
+    {
+        actions[n].ps2key       = keymap_sent[key];                             // same key as on press, whatever shift is held now
+        actions[n].released     = 1;
+        n++;
+        keymap_sent[key]        = PS2KBD_KEY_NONE;
+
+        if (keymap_layered & ZXKBD_KEY_BIT(key))
+        {
+            keymap_layered &= ~ZXKBD_KEY_BIT(key);
+
+            if (! keymap_layered)                                               // last layer key released: restore physical shift
+            {
+                n += keymap_set_mods (keymap_held, actions + n);
+            }
+        }
+    }
+
+    return n;
+#else
+    actions[0].ps2key   = keymap_ps2key (key);
+    actions[0].released = (state == ZXKBD_KEY_RELEASED);
+    return 1;
+#endif
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap_repeat () - get PS/2 key to repeat for a held matrix key, the one sent on press
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+keymap_repeat (uint_fast8_t key)
+{
+#if KEYMAP_LAYERS == 1
+    return keymap_sent[key];
+#else
+    return keymap_ps2key (key);
+#endif
+}
@@ -0,0 +1,54 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * keymap.h - mapping of ZX keyboard matrix to PS/2 keys, CAPS SHIFT and SYMBOL SHIFT layers
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include <stdint.h>
+#include "zxkbd.h"
+
+/* 1 = CAPS SHIFT / SYMBOL SHIFT combinations are translated to PC keys, 0 = CS and SS are sent as LSHFT and LCTRL only */
+#ifndef KEYMAP_LAYERS
+#define KEYMAP_LAYERS           1
+#endif
+
+#define KEYMAP_KEY_CS           ZXKBD_KEY_INDEX(0, 0)                           // matrix position of CAPS SHIFT
+#define KEYMAP_KEY_SS           ZXKBD_KEY_INDEX(7, 1)                           // matrix position of SYMBOL SHIFT
+#define KEYMAP_MAX_ACTIONS      3                                               // max. PS/2 key events per matrix key event
+
+typedef struct
+{
+    uint8_t                     ps2key;                                         // PS2KBD_KEY_xxx
+    uint8_t                     released;                                       // 0 = make, 1 = break
+} keymap_action_t;
+
+extern void                     keymap_init (void);
+extern uint_fast8_t             keymap_ps2key (uint_fast8_t key);
+extern zxkbd_bitmap_t           keymap_modifiers (void);
+extern uint_fast8_t             keymap_event (uint_fast8_t key, uint_fast8_t state, keymap_action_t * actions);
+extern uint_fast8_t             keymap_repeat (uint_fast8_t key);
+
+#endif
@@ -62,20 +62,399 @@
 #include "delay.h"
 #include "board-led.h"
 #include "zxkbd.h"
+#include "zxkbd-typematic.h"
+#include "zxkbd-order.h"
+#include "zxkbd-events.h"
 #include "serial.h"
 #include "ps2kbd.h"
+#include "sched.h"
+#include "keymap.h"
+#include "keymap-macro.h"
+#include "keymap-combo.h"
 
-static const uint16_t       scancodes[ZX_KBD_ROWS][ZX_KBD_EXT_COLS] =
-{   //      D0                      D1                     D2                  D3                  D4                 D5 (extra col)
-    {   PS2KBD_SCANCODE_LSHFT,  PS2KBD_SCANCODE_Z,     PS2KBD_SCANCODE_X,  PS2KBD_SCANCODE_C,  PS2KBD_SCANCODE_V,  PS2KBD_SCANCODE_TAB  },
-    {   PS2KBD_SCANCODE_A,      PS2KBD_SCANCODE_S,     PS2KBD_SCANCODE_D,  PS2KBD_SCANCODE_F,  PS2KBD_SCANCODE_G,         0             },
-    {   PS2KBD_SCANCODE_Q,      PS2KBD_SCANCODE_W,     PS2KBD_SCANCODE_E,  PS2KBD_SCANCODE_R,  PS2KBD_SCANCODE_T,         0             },
-    {   PS2KBD_SCANCODE_1,      PS2KBD_SCANCODE_2,     PS2KBD_SCANCODE_3,  PS2KBD_SCANCODE_4,  PS2KBD_SCANCODE_5,         0             },
-    {   PS2KBD_SCANCODE_0,      PS2KBD_SCANCODE_9,     PS2KBD_SCANCODE_8,  PS2KBD_SCANCODE_7,  PS2KBD_SCANCODE_6,         0             },
-    {   PS2KBD_SCANCODE_P,      PS2KBD_SCANCODE_O,     PS2KBD_SCANCODE_I,  PS2KBD_SCANCODE_U,  PS2KBD_SCANCODE_Y,         0             },
-    {   PS2KBD_SCANCODE_ENTER,  PS2KBD_SCANCODE_L,     PS2KBD_SCANCODE_K,  PS2KBD_SCANCODE_J,  PS2KBD_SCANCODE_H,         0             },
-    {   PS2KBD_SCANCODE_SPACE,  PS2KBD_SCANCODE_LCTRL, PS2KBD_SCANCODE_M,  PS2KBD_SCANCODE_N,  PS2KBD_SCANCODE_B,         0             },
-};
+#define HOST_RX_POLL_USEC           5000                                    // UART RX buffer (64 bytes) fills in 16 msec at 38400 Bd
+#define HOST_CMD_CALIBRATE          0xEB                                    // UART only, unused in PS/2 command set: calibrate rows
+#define CALIBRATE_RETRY_USEC        1000                                    // calibration waits until PS/2 is idle
+#define PS2_EVENT_MAX_CODES         (KEYMAP_MAX_ACTIONS * PS2KBD_MAX_CODES) // PS/2 codes of one matrix key event, worst case
+#define PS2_RETRY_USEC              1000                                    // PS/2 TX queue full: try again after about one byte
+
+#if (1 + KEYMAP_MACRO_MAX_HELD) * PS2_EVENT_MAX_CODES > PS2KBD_TXBUFLEN
+#error PS/2 TX queue too small for a key press cancelling a macro
+#endif
+
+static zxkbd_bitmap_t       reported_keys;                                  // keys sent as pressed, without keys of combos
+static uint_fast8_t         host_uart_active;                               // flag: host command received per UART, see idle()
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2_room () - check if PS/2 TX queue takes the codes of n matrix key events
+ *
+ * ps2kbd_send_codes() does not wait if the queue is full. An event is only taken from its queue if its codes fit,
+ * otherwise it stays queued and the task is run again after PS2_RETRY_USEC.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+ps2_room (uint_fast8_t n)
+{
+    return (ps2kbd_tx_free () >= n * PS2_EVENT_MAX_CODES) ? 1 : 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * send_ps2key () - send PS/2 codes of a pressed or released PS/2 key
+ *
+ * UART always gets scan code set 2, PS/2 gets the scan code set selected by the host. Unused matrix positions
+ * map to PS2KBD_KEY_NONE, whose sequences are empty. The callers check ps2_room() before they take an event, so
+ * the PS/2 TX queue takes the codes.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+send_ps2key (uint_fast8_t ps2key, uint_fast8_t released)
+{
+    const ps2kbd_seq_t *    seq;
+
+    seq = ps2kbd_key_sequence (PS2KBD_SET_2, ps2key, released);
+    serial_write ((char *) seq->codes, seq->len);                           // send codes per UART
+
+    seq = ps2kbd_key_sequence (ps2kbd_get_scancode_set (), ps2key, released);
+    ps2kbd_send_codes (seq->codes, seq->len);                               // send codes per PS/2
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * send_key_event () - send PS/2 keys of a pressed or released matrix key, translated by keymap layers
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+send_key_event (uint_fast8_t key, uint_fast8_t state)
+{
+    keymap_action_t actions[KEYMAP_MAX_ACTIONS];
+    uint_fast8_t    n;
+    uint_fast8_t    i;
+
+    n = keymap_event (key, state, actions);
+
+    for (i = 0; i < n; i++)
+    {
+        send_ps2key (actions[i].ps2key, actions[i].released);
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * macro_task () - send macro events until next one is not yet due
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+macro_task (void)
+{
+    uint_fast8_t    key;
+    uint_fast8_t    state;
+    uint32_t        usec;
+
+    while (keymap_macro_playing ())
+    {
+        if (! ps2_room (1))
+        {
+            sched_at (SCHED_TASK_MACRO, PS2_RETRY_USEC);                    // PS/2 TX queue full
+            break;
+        }
+
+        if (! keymap_macro_next (&key, &state, &usec))
+        {
+            break;
+        }
+
+        send_key_event (key, state);
+
+        if (usec)
+        {
+            sched_at (SCHED_TASK_MACRO, usec);                              // pacing, scanning goes on meanwhile
+            break;
+        }
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * held_keys () - get keys held on host: keys sent as pressed and keys of combos sent as pressed
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static zxkbd_bitmap_t
+held_keys (void)
+{
+    return reported_keys | keymap_combo_held ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * send_combo_events () - send key events leaving the combo stage
+ *
+ * A press during macro playback releases the keys of the macro first, so room for them is needed, too.
+ *
+ * Return value: 1 = all events sent, 0 = PS/2 TX queue full, events stay in the stage and the key event task is
+ * run again after PS2_RETRY_USEC
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+send_combo_events (void)
+{
+    zxkbd_event_t   event;
+    zxkbd_bitmap_t  last_keys = held_keys ();
+    uint_fast8_t    ps2key;
+    uint_fast8_t    macro;
+    uint_fast8_t    rc = 1;
+
+    for (;;)
+    {
+        if (! ps2_room (keymap_macro_playing () ? 1 + KEYMAP_MACRO_MAX_HELD : 1))
+        {
+            sched_at (SCHED_TASK_KEY_EVENTS, PS2_RETRY_USEC);
+            rc = 0;
+            break;
+        }
+
+        if (! keymap_combo_get (&event, &ps2key))
+        {
+            break;
+        }
+
+        if (ps2key != PS2KBD_KEY_NONE)                                      // combo detected: its PS/2 key instead of its keys
+        {
+            send_ps2key (ps2key, event.state == ZXKBD_KEY_RELEASED);
+        }
+        else
+        {
+            macro = keymap_macro_event (event.key, event.state);
+
+            if ((macro & KEYMAP_MACRO_RUN) && event.state == ZXKBD_KEY_PRESSED)  // release keys of cancelled macro first
+            {
+                macro_task ();
+            }
+
+            if (! (macro & KEYMAP_MACRO_CONSUMED))                          // trigger key is not sent
+            {
+                send_key_event (event.key, event.state);
+            }
+
+            if ((macro & KEYMAP_MACRO_RUN) && event.state == ZXKBD_KEY_RELEASED)  // trigger released: play macro now
+            {
+                macro_task ();
+            }
+
+            if (event.state == ZXKBD_KEY_PRESSED)
+            {
+                reported_keys |= ZXKBD_KEY_BIT(event.key);
+            }
+            else
+            {
+                reported_keys &= ~ZXKBD_KEY_BIT(event.key);
+            }
+        }
+
+#if ZXKBD_TYPEMATIC == 1
+        zxkbd_typematic_set (ps2kbd_get_typematic ());                      // rate/delay may be changed by host
+        zxkbd_typematic_update (held_keys (), ZXKBD_KEY_BIT(event.key));    // keys held back by rollover don't repeat
+#endif
+    }
+
+    if (! last_keys != ! held_keys ())                                     // first key pressed or last key released
+    {
+        sched_post (SCHED_TASK_LED);
+    }
+
+    return rc;
+}
+
+#if KEYMAP_COMBO_REPORT == 1
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * combo_report () - report added latency of combo stage per UART, if events were held back since last report
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+combo_report (void)
+{
+    static uint32_t         last_held;
+    keymap_combo_stats_t    stats;
+
+    keymap_combo_get_stats (&stats);
+
+    if (stats.held != last_held)
+    {
+        last_held = stats.held;
+        serial_printf ("combo: %lu of %lu events held, avg %lu usec, max %lu usec, %lu combos\r\n",
+                       stats.held, stats.events, stats.sum_usec / stats.held, stats.max_usec, stats.combos);
+    }
+}
+#endif
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * combo_task () - send presses held back by combo stage if their window has elapsed, re-arm deadline
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+combo_task (void)
+{
+    uint32_t        usec;
+
+    usec = keymap_combo_poll ();
+    send_combo_events ();
+
+    if (usec)
+    {
+        sched_at (SCHED_TASK_COMBO, usec);                                  // presses still held back
+    }
+#if KEYMAP_COMBO_REPORT == 1
+    combo_report ();
+#endif
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * key_events_task () - send key events queued by scan ISR, already ordered, through combo stage
+ *
+ * The next event is taken from the queue only when the combo stage is empty again: events don't get lost while
+ * the PS/2 TX queue is full, they stay in the key event queue, see zxkbd_frame_complete().
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+key_events_task (void)
+{
+    zxkbd_event_t   event;
+
+    while (send_combo_events () && zxkbd_events_get (&event))
+    {
+        keymap_combo_put (&event);
+    }
+
+    combo_task ();
+}
+
+#if ZXKBD_TYPEMATIC == 1
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * typematic_task () - send repeated key, repeat delay or period elapsed
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+typematic_task (void)
+{
+    uint_fast8_t    key;
+    uint_fast8_t    ps2key;
+
+    if (ps2_room (1) && zxkbd_typematic_poll (&key))                        // queue full: repeat at next period
+    {
+        ps2key = keymap_combo_ps2key (key);                                 // key of held combo: repeat combo
+
+        if (ps2key == PS2KBD_KEY_NONE)
+        {
+            ps2key = keymap_repeat (key);                                   // same PS/2 key as sent on press
+        }
+
+        send_ps2key (ps2key, 0);
+    }
+}
+#endif
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * calibrate_task () - measure settle time of rows, posted at boot and by HOST_CMD_CALIBRATE
+ *
+ * Waits until PS/2 is idle, e.g. after the power-on BAT: PS/2 interrupts would stretch the measurements.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+calibrate_task (void)
+{
+    if (ps2kbd_busy ())
+    {
+        sched_at (SCHED_TASK_CALIBRATE, CALIBRATE_RETRY_USEC);
+        return;
+    }
+
+    zxkbd_calibrate ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * host_rx_task () - handle PS/2 host commands received per UART, replies are sent back per UART
+ *
+ * HOST_CMD_CALIBRATE is answered with ACK and starts calibrate_task().
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+host_rx_task (void)
+{
+    uint8_t         reply[PS2KBD_MAX_REPLY];
+    uint_fast8_t    ch;
+    uint_fast8_t    n;
+
+    while (serial_poll (&ch))
+    {
+        host_uart_active = 1;
+
+        if (ch == HOST_CMD_CALIBRATE)
+        {
+            sched_post (SCHED_TASK_CALIBRATE);
+            reply[0] = PS2KBD_REPLY_ACK;
+            n = 1;
+        }
+        else
+        {
+            n = ps2kbd_uart_command (ch, reply);
+        }
+
+        serial_write ((char *) reply, n);
+    }
+
+    sched_at (SCHED_TASK_HOST_RX, HOST_RX_POLL_USEC);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * led_task () - LED lit while any key pressed
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+led_task (void)
+{
+    if (held_keys ())
+    {
+        board_led_on ();
+    }
+    else
+    {
+        board_led_off ();
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * host_busy () - PS/2 busy or UART byte received, ends zxkbd_sleep()
+ *
+ * The RXNE interrupt of the UART ends WFI, so a command per UART is handled at once, not after the next key press.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+host_busy (void)
+{
+    return (ps2kbd_busy () || serial_rxsize () > 0) ? 1 : 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * idle () - no task ready: sleep until next interrupt, deeper if keyboard is idle
+ *
+ * The USART is not clocked in STOP mode: once the host has sent commands per UART, the keyboard sleeps with WFI only.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+idle (void)
+{
+#if ZXKBD_SLEEP_MODE != ZXKBD_SLEEP_MODE_NONE
+#if ZXKBD_SLEEP_MODE == ZXKBD_SLEEP_MODE_STOP
+    if (host_uart_active)
+    {
+        sched_wait ();                                                      // UART host: STOP would lose received bytes
+        return;
+    }
+#endif
+    if (zxkbd_idle () && ! host_busy () && ! zxkbd_events_pending () && ! keymap_macro_playing ())  // nothing pressed for a while, all codes sent
+    {
+        zxkbd_sleep (host_busy);                                            // wait for key press or host command
+        sched_expire ();                                                    // slept for unknown time: deadlines are due
+        return;
+    }
+#endif
+    sched_wait ();
+}
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * main function
@@ -84,12 +463,6 @@ static const uint16_t       scancodes[ZX_KBD_ROWS][ZX_KBD_EXT_COLS] =
 int
 main (void)
 {
-    uint_fast8_t    row;
-    uint_fast8_t    col;
-    uint_fast8_t    state;
-    uint16_t        ps2key_scancode;
-    uint32_t        delay_value;
-
     SystemInit ();
     SystemCoreClockUpdate ();
 
@@ -98,67 +471,44 @@ main (void)
     GPIO_PinRemapConfig (GPIO_Remap_SWJ_JTAGDisable, ENABLE);               // disable JTAG, enable SWD
 #endif
 
+    NVIC_PriorityGroupConfig (NVIC_PriorityGroup_2);                        // 2 bits preemption, 2 bits sub priority
+                                                                            // 0: PS/2, 1: scan + UART, 2: typematic
     delay_init (DELAY_RESOLUTION_5_US);
     board_led_init ();
     serial_init (38400);
     ps2kbd_init ();
     zxkbd_init ();
+    keymap_init ();
+    keymap_macro_init ();
+    keymap_combo_init ();
+    zxkbd_order_init (keymap_modifiers (), ZXKBD_ROLLOVER);                 // used by scan ISR, see zxkbd_frame_complete()
+#if ZXKBD_TYPEMATIC == 1
+    zxkbd_typematic_init ();
+#endif
+    zxkbd_scan_start (ZXKBD_SCAN_ROW_USEC);                                 // rows are scanned by timer interrupt or DMA
+    ps2kbd_power_on ();                                                     // ready: send BAT to host
 
-    while (1)
+#if PS2KBD_BAT_REPORT == 1
+    while (ps2kbd_busy ())
     {
-        for (row = 0; row < ZX_KBD_ROWS; row++)
-        {
-            delay_value = 4000;                                             // debounce: 8 x 4000 usec = 32 msec
-
-            zxkbd_io (row);                                                 // read columns of row
-
-            if (zxkbd_row_changed (row))
-            {
-                for (col = 0; col < ZX_KBD_EXT_COLS; col++)
-                {
-                    state = zxkbd_key_state (row, col);
-
-                    if (state != ZXKBD_KEY_NOCHANGE)
-                    {
-                        ps2key_scancode = scancodes[row][col];
-
-                        if (ps2key_scancode)
-                        {
-                            if (ps2key_scancode & PS2KBD_EXTENDED_FLAG)
-                            {
-                                serial_putc (0xE0);                         // send extend code per UART
-                                ps2kbd_send_code (0xE0);                    // send extend code per PS/2
-
-                                if (delay_value > 330)
-                                {
-                                    delay_value -= 330;                     // sending code per PS/2 takes 11 x 30usec = 330usec
-                                }
-                            }
-
-                            if (state == ZXKBD_KEY_RELEASED)                // key released?
-                            {
-                                serial_putc (0xF0);                         // send break code per UART
-                                ps2kbd_send_code (0xF0);                    // send break code per PS/2
-
-                                if (delay_value > 330)
-                                {
-                                    delay_value -= 330;                     // sending code per PS/2 takes 11 x 30usec = 330usec
-                                }
-                            }
-
-                            serial_putc (ps2key_scancode & 0xFF);           // send 8 bit scancode per UART
-                            ps2kbd_send_code (ps2key_scancode & 0xFF);      // send 8 bit scancode per PS/2
-
-                            if (delay_value > 330)
-                            {
-                                delay_value -= 330;                         // sending code per PS/2 takes 11 x 30usec = 330usec
-                            }
-                        }
-                    }
-                }
-            }
-
-            delay_usec (delay_value);                                       // debounce: 8 x 4000 usec = 32 msec
-        }
+        ;
     }
+    serial_printf ("PS/2 BAT: %lu usec, budget %lu usec\r\n", ps2kbd_get_bat_usec (), (uint32_t) PS2KBD_BAT_BUDGET_USEC);
+#endif
+#if PS2KBD_BURST_TEST == 1
+    serial_printf ("PS/2 burst: %lu bytes/s\r\n", ps2kbd_burst_test (0x00, PS2KBD_BURST_TEST_BYTES));
+#endif
+
+    sched_add (SCHED_TASK_KEY_EVENTS, key_events_task);
+    sched_add (SCHED_TASK_COMBO, combo_task);
+#if ZXKBD_TYPEMATIC == 1
+    sched_add (SCHED_TASK_TYPEMATIC, typematic_task);
+#endif
+    sched_add (SCHED_TASK_MACRO, macro_task);
+    sched_add (SCHED_TASK_HOST_RX, host_rx_task);
+    sched_add (SCHED_TASK_LED, led_task);
+    sched_add (SCHED_TASK_CALIBRATE, calibrate_task);
+    sched_post (SCHED_TASK_HOST_RX);                                        // polls UART, then re-arms its deadline
+    sched_post (SCHED_TASK_CALIBRATE);                                      // settle time of rows, after BAT
+    sched_run (idle);                                                       // never returns
 }
@@ -36,8 +36,8 @@
 #include "stm32f10x_rcc.h"
 #include "stm32f10x_tim.h"
 #include "stm32f10x_dma.h"
+#include "misc.h"
 
-#include "delay.h"
 #include "io.h"
 #include "ps2kbd.h"
 
@@ -48,98 +48,1271 @@
 #define PS2_PERIPH_DATA_PORT    RCC_APB2Periph_GPIOB
 #define PS2_DATA_PORT           GPIOB
 #define PS2_DATA_PIN            GPIO_Pin_13
+#define PS2_DATA_PORT_SOURCE    GPIO_PortSourceGPIOB
+#define PS2_DATA_PIN_SOURCE     GPIO_PinSource13
+#define PS2_DATA_EXTI_LINE      EXTI_Line13
+
+#define PS2_FRAME_BITS          11                                              // start bit, 8 data bits, parity, stop bit
+
+/* transceiver states */
+#define PS2_STATE_IDLE          0                                               // lines released, EXTI armed on data line
+#define PS2_STATE_TX            1                                               // device sends a byte
+#define PS2_STATE_RX_WAIT       2                                               // host requests to send, wait until host releases clock
+#define PS2_STATE_RX            3                                               // device clocks in a byte from host
+#define PS2_STATE_INHIBIT       4                                               // host holds clock low, wait until released
+
+/* results of ps2kbd_tx_tick() */
+#define PS2_TX_BUSY             0
+#define PS2_TX_DONE             1
+#define PS2_TX_ABORTED          2
+
+#define PS2_INHIBIT_RELEASE_TICKS   4                                           // clock must be high for 4 ticks (>= 60 usec) before sending
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * frame table: 11 bit frame of each byte value, LSB first: start bit 0, 8 data bits, odd parity, stop bit 1
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define PS2_PARITY(b)           (((b) ^ ((b) >> 1) ^ ((b) >> 2) ^ ((b) >> 3) ^ ((b) >> 4) ^ ((b) >> 5) ^ ((b) >> 6) ^ ((b) >> 7)) & 0x01)
+#define PS2_FRAME(b)            ((1 << 10) | ((PS2_PARITY(b) ^ 0x01) << 9) | ((b) << 1))
+#define PS2_FRAME4(b)           PS2_FRAME(b), PS2_FRAME((b) + 1), PS2_FRAME((b) + 2), PS2_FRAME((b) + 3)
+#define PS2_FRAME16(b)          PS2_FRAME4(b), PS2_FRAME4((b) + 4), PS2_FRAME4((b) + 8), PS2_FRAME4((b) + 12)
+#define PS2_FRAME64(b)          PS2_FRAME16(b), PS2_FRAME16((b) + 16), PS2_FRAME16((b) + 32), PS2_FRAME16((b) + 48)
+
+static const uint16_t           ps2kbd_frame_table[256] =
+{
+    PS2_FRAME64(0x00), PS2_FRAME64(0x40), PS2_FRAME64(0x80), PS2_FRAME64(0xC0)
+};
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * make and break sequences, generated from PS2KBD_KEY_LIST at compile time
+ *
+ * index: [set - 1][PS2KBD_KEY_xxx][released], the E0 prefix and break encoding of each set are resolved here,
+ * so sending a key event needs no branches per byte.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define PS2_EXT(c)              (((c) & PS2KBD_EXTENDED_FLAG) ? 1 : 0)          // 1 = E0 prefix
+#define PS2_LOW(c)              ((c) & 0xFF)
+
+#define PS2_SEQ_MAKE(c)         { 1 + PS2_EXT(c), { PS2_EXT(c) ? 0xE0 : PS2_LOW(c), PS2_EXT(c) ? PS2_LOW(c) : 0x00, 0x00 } }
+#define PS2_SEQ_BREAK_80(c)     { 1 + PS2_EXT(c), { PS2_EXT(c) ? 0xE0 : PS2_LOW(c) | 0x80, PS2_EXT(c) ? PS2_LOW(c) | 0x80 : 0x00, 0x00 } }
+#define PS2_SEQ_BREAK_F0(c)     { 2 + PS2_EXT(c), { PS2_EXT(c) ? 0xE0 : 0xF0, PS2_EXT(c) ? 0xF0 : PS2_LOW(c), PS2_EXT(c) ? PS2_LOW(c) : 0x00 } }
+#define PS2_SEQ_NONE            { { 0, { 0 } }, { 0, { 0 } } }
+
+#define PS2_SET1_SEQ(name,s1,s2,s3)     { PS2_SEQ_MAKE(s1), PS2_SEQ_BREAK_80(s1) },     // set 1: break = make | 0x80
+#define PS2_SET2_SEQ(name,s1,s2,s3)     { PS2_SEQ_MAKE(s2), PS2_SEQ_BREAK_F0(s2) },     // set 2: break = F0 make
+#define PS2_SET3_SEQ(name,s1,s2,s3)     { PS2_SEQ_MAKE(s3), PS2_SEQ_BREAK_F0(s3) },     // set 3: break = F0 make, no E0 codes
+
+static const ps2kbd_seq_t       ps2kbd_sequences[3][PS2KBD_KEYS][2] =
+{
+    { PS2_SEQ_NONE, PS2KBD_KEY_LIST(PS2_SET1_SEQ) },
+    { PS2_SEQ_NONE, PS2KBD_KEY_LIST(PS2_SET2_SEQ) },
+    { PS2_SEQ_NONE, PS2KBD_KEY_LIST(PS2_SET3_SEQ) },
+};
+
+static volatile uint8_t         ps2kbd_txbuf[PS2KBD_TXBUFLEN];                  // tx ringbuffer
+static volatile uint_fast8_t    ps2kbd_txsize;                                  // tx size
+static uint_fast8_t             ps2kbd_txstart;                                 // head, only used by ISR
+static uint_fast8_t             ps2kbd_txstop;                                  // tail, only used by ps2kbd_send_codes()
+
+static volatile uint_fast8_t    ps2kbd_state = PS2_STATE_IDLE;                  // transceiver state
+static uint_fast16_t            ps2kbd_frame;                                   // frame in progress, TX or RX
+static uint_fast8_t             ps2kbd_bit;                                     // current bit of frame
+static uint_fast8_t             ps2kbd_tick;                                    // current tick of bit
+
+static uint8_t                  ps2kbd_reply[2 * PS2KBD_MAX_REPLY];             // replies to host command, sent before scancodes
+static uint_fast8_t             ps2kbd_reply_len;
+static uint_fast8_t             ps2kbd_reply_pos;
+static uint_fast8_t             ps2kbd_last_byte;                               // last byte sent, for PS2KBD_CMD_RESEND
+static uint_fast8_t             ps2kbd_last_is_reply;                           // flag: last byte was a reply to host command
+static uint_fast8_t             ps2kbd_retry_pending;                           // flag: a byte was aborted, send it again
+static uint_fast8_t             ps2kbd_retry_byte;                              // aborted byte
+static uint_fast8_t             ps2kbd_retry_is_reply;                          // flag: aborted byte was a reply to host command
+static uint_fast8_t             ps2kbd_inhibit_ticks;                           // ticks with clock released after inhibit
+static ps2kbd_stats_t           ps2kbd_stats;                                   // counters, see ps2kbd_get_stats()
+static uint_fast8_t             ps2kbd_cmd_pending;                             // command waiting for its argument byte
+static uint_fast8_t             ps2kbd_uart_cmd_pending;                        // same for commands received per UART
+static uint_fast8_t             ps2kbd_uart_last_reply;                         // last reply byte sent per UART, for PS2KBD_CMD_RESEND
+
+static volatile uint_fast8_t    ps2kbd_enabled = 1;                             // 0 = disabled by host, scancodes are dropped
+static volatile uint_fast8_t    ps2kbd_leds;                                    // LED state set by host
+static volatile uint_fast8_t    ps2kbd_typematic = PS2KBD_TYPEMATIC_DEFAULT;    // typematic rate/delay set by host
+static volatile uint_fast8_t    ps2kbd_scancode_set = PS2KBD_SET_2;             // scan code set selected by host
+
+static volatile uint_fast8_t    ps2kbd_tick_usec = PS2KBD_TX_TICK_USEC;         // length of tick, see ps2kbd_set_timing()
+static volatile uint_fast8_t    ps2kbd_gap_ticks = PS2KBD_TX_GAP_TICKS;         // idle ticks after each byte
+
+static uint_fast8_t             ps2kbd_bat_pending;                             // flag: power-on BAT queued, not yet sent
+static volatile uint32_t        ps2kbd_bat_usec;                                // time from clock setup to end of power-on BAT
+
+void TIM4_IRQHandler (void);                                                    // keep compiler happy
+void EXTI15_10_IRQHandler (void);                                               // keep compiler happy
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_clock_low() - set clock pin to LOW
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_clock_low ()
+{
+    GPIO_RESET_BIT (PS2_CLOCK_PORT, PS2_CLOCK_PIN);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_clock_high() - set clock pin to HIGH
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_clock_high ()
+{
+    GPIO_SET_BIT (PS2_CLOCK_PORT, PS2_CLOCK_PIN);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_data_low() - set data pin to LOW
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_data_low ()
+{
+    GPIO_RESET_BIT (PS2_DATA_PORT, PS2_DATA_PIN);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_data_high() - set data pin to HIGH
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_data_high ()
+{
+    GPIO_SET_BIT (PS2_DATA_PORT, PS2_DATA_PIN);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_clock_is_low() - check if clock line is LOW (pulled down by us or by host)
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+ps2kbd_clock_is_low ()
+{
+    return (PS2_CLOCK_PORT->IDR & PS2_CLOCK_PIN) ? 0 : 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_data_is_low() - check if data line is LOW (pulled down by us or by host)
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+ps2kbd_data_is_low ()
+{
+    return (PS2_DATA_PORT->IDR & PS2_DATA_PIN) ? 0 : 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_exti_cmd () - arm or disarm EXTI on falling edge of data line (host request to send)
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_exti_cmd (FunctionalState state)
+{
+    EXTI_InitTypeDef    exti;
+
+    EXTI_ClearITPendingBit (PS2_DATA_EXTI_LINE);
+    EXTI_StructInit (&exti);
+    exti.EXTI_Line      = PS2_DATA_EXTI_LINE;
+    exti.EXTI_Mode      = EXTI_Mode_Interrupt;
+    exti.EXTI_Trigger   = EXTI_Trigger_Falling;
+    exti.EXTI_LineCmd   = state;
+    EXTI_Init (&exti);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_timer_start () - start TIM4 if not running, first tick after one tick length
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_timer_start (void)
+{
+    if (! (TIM4->CR1 & TIM_CR1_CEN))
+    {
+        TIM_SetCounter (TIM4, 0);
+        TIM_Cmd (TIM4, ENABLE);
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_reply_add () - add reply byte for the PS/2 line, called by ISR
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_reply_add (uint_fast8_t ch)
+{
+    if (ps2kbd_reply_len < sizeof (ps2kbd_reply))
+    {
+        ps2kbd_reply[ps2kbd_reply_len++] = ch;
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_flush () - drop all queued scancodes, called by ISR
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_flush (void)
+{
+    ps2kbd_retry_pending = 0;
+    ps2kbd_txstart = (ps2kbd_txstart + ps2kbd_txsize) % PS2KBD_TXBUFLEN;
+    ps2kbd_txsize = 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_next_byte () - get next byte to send: aborted reply first, then replies, then aborted scancode, then queued scancodes
+ *
+ * Return value: 1 = byte stored in *chp, 0 = nothing to send
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+ps2kbd_next_byte (uint_fast8_t * chp)
+{
+    if (ps2kbd_retry_pending && ps2kbd_retry_is_reply)                          // aborted reply first
+    {
+        ps2kbd_retry_pending = 0;
+        ps2kbd_stats.retries++;
+        *chp = ps2kbd_retry_byte;
+        ps2kbd_last_is_reply = 1;
+    }
+    else if (ps2kbd_reply_pos < ps2kbd_reply_len)
+    {
+        *chp = ps2kbd_reply[ps2kbd_reply_pos++];
+        ps2kbd_last_is_reply = 1;
+    }
+    else if (ps2kbd_retry_pending)                                              // aborted scancode after the replies
+    {
+        ps2kbd_retry_pending = 0;
+        ps2kbd_stats.retries++;
+        *chp = ps2kbd_retry_byte;
+        ps2kbd_last_is_reply = 0;
+    }
+    else if (ps2kbd_txsize > 0)
+    {
+        *chp = ps2kbd_txbuf[ps2kbd_txstart++];
+
+        if (ps2kbd_txstart == PS2KBD_TXBUFLEN)                                  // at end of tx buffer?
+        {
+            ps2kbd_txstart = 0;                                                 // reset to beginning
+        }
+
+        ps2kbd_txsize--;
+        ps2kbd_last_is_reply = 0;
+    }
+    else
+    {
+        ps2kbd_reply_len = 0;
+        ps2kbd_reply_pos = 0;
+        return 0;
+    }
+
+    ps2kbd_last_byte = *chp;
+    return 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_defaults () - reset settings changeable by host
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_defaults (void)
+{
+    ps2kbd_typematic = PS2KBD_TYPEMATIC_DEFAULT;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_command () - handle command byte, interrupts must be locked
+ *
+ * ED, F0 and F3 expect an argument byte. A byte with bit 7 set is never an argument but a new command.
+ * *cmd_pendingp holds the command waiting for its argument, one per host interface. The replies are stored in
+ * reply, at most PS2KBD_MAX_REPLY bytes.
+ *
+ * Settings (LEDs, typematic, scan code set, enable) are shared by both interfaces. The state of the PS/2 line is
+ * only touched if ps2 is 1: queued scancodes are dropped, PS2KBD_CMD_RESEND answers with the last byte sent on
+ * the PS/2 line. On the UART it answers with ps2kbd_uart_last_reply.
+ *
+ * Return value: number of reply bytes
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+ps2kbd_command (uint_fast8_t ch, uint_fast8_t * cmd_pendingp, uint8_t * reply, uint_fast8_t ps2)
+{
+    uint_fast8_t    n = 0;
+
+    if (*cmd_pendingp && ! (ch & 0x80))                                         // argument of ED, F0 or F3
+    {
+        if (*cmd_pendingp == PS2KBD_CMD_SET_LEDS)
+        {
+            ps2kbd_leds = ch & 0x07;
+            reply[n++] = PS2KBD_REPLY_ACK;
+        }
+        else if (*cmd_pendingp == PS2KBD_CMD_SCANCODE_SET)
+        {
+            if (ch == 0)                                                        // get current set
+            {
+                reply[n++] = PS2KBD_REPLY_ACK;
+                reply[n++] = ps2kbd_scancode_set;
+            }
+            else if (ch <= PS2KBD_SET_3)
+            {
+                if (ps2)
+                {
+                    ps2kbd_flush ();                                            // queued codes belong to old set
+                }
+
+                ps2kbd_scancode_set = ch;
+                reply[n++] = PS2KBD_REPLY_ACK;
+            }
+            else
+            {
+                reply[n++] = PS2KBD_REPLY_RESEND;
+            }
+        }
+        else
+        {
+            ps2kbd_typematic = ch & 0x7F;
+            reply[n++] = PS2KBD_REPLY_ACK;
+        }
+
+        *cmd_pendingp = 0;
+        return n;
+    }
+
+    *cmd_pendingp = 0;
+
+    switch (ch)
+    {
+        case PS2KBD_CMD_SET_LEDS:
+        case PS2KBD_CMD_SCANCODE_SET:
+        case PS2KBD_CMD_TYPEMATIC:
+        {
+            *cmd_pendingp = ch;
+            reply[n++] = PS2KBD_REPLY_ACK;
+            break;
+        }
+        case PS2KBD_CMD_ECHO:
+        {
+            reply[n++] = PS2KBD_REPLY_ECHO;
+            break;
+        }
+        case PS2KBD_CMD_READ_ID:
+        {
+            reply[n++] = PS2KBD_REPLY_ACK;
+            reply[n++] = PS2KBD_REPLY_ID1;
+            reply[n++] = PS2KBD_REPLY_ID2;
+            break;
+        }
+        case PS2KBD_CMD_ENABLE:
+        {
+            if (ps2)
+            {
+                ps2kbd_flush ();
+            }
+
+            ps2kbd_enabled = 1;
+            reply[n++] = PS2KBD_REPLY_ACK;
+            break;
+        }
+        case PS2KBD_CMD_DISABLE:
+        {
+            if (ps2)
+            {
+                ps2kbd_flush ();
+            }
+
+            ps2kbd_defaults ();
+            ps2kbd_enabled = 0;
+            reply[n++] = PS2KBD_REPLY_ACK;
+            break;
+        }
+        case PS2KBD_CMD_DEFAULTS:
+        {
+            ps2kbd_defaults ();
+            reply[n++] = PS2KBD_REPLY_ACK;
+            break;
+        }
+        case PS2KBD_CMD_RESEND:
+        {
+            if (ps2)
+            {
+                if (! ps2kbd_last_is_reply)                                     // aborted scancode was the last byte
+                {
+                    ps2kbd_retry_pending = 0;
+                }
+
+                reply[n++] = ps2kbd_last_byte;                                  // no ACK, only the last byte again
+                ps2kbd_stats.resends++;
+            }
+            else
+            {
+                reply[n++] = ps2kbd_uart_last_reply;
+            }
+            break;
+        }
+        case PS2KBD_CMD_RESET:
+        {
+            if (ps2)
+            {
+                ps2kbd_flush ();
+            }
+
+            ps2kbd_defaults ();
+            ps2kbd_leds = 0;
+            ps2kbd_scancode_set = PS2KBD_SET_2;
+            ps2kbd_enabled = 1;
+            reply[n++] = PS2KBD_REPLY_ACK;
+            reply[n++] = PS2KBD_REPLY_BAT_OK;
+            break;
+        }
+        default:
+        {
+            if (ch >= 0xF7)                                                     // F7 - FD: scan code set 3 key types, ignored
+            {
+                reply[n++] = PS2KBD_REPLY_ACK;
+            }
+            else
+            {
+                reply[n++] = PS2KBD_REPLY_RESEND;                               // unknown command
+            }
+            break;
+        }
+    }
+
+    return n;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_host_command () - handle byte received from host, called by ISR
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_host_command (uint_fast8_t ch)
+{
+    uint8_t         reply[PS2KBD_MAX_REPLY];
+    uint_fast8_t    n;
+    uint_fast8_t    i;
+
+    ps2kbd_reply_len = 0;                                                       // new command cancels pending replies
+    ps2kbd_reply_pos = 0;
+
+    if (ps2kbd_retry_is_reply)                                                  // ... and an aborted reply
+    {
+        ps2kbd_retry_pending = 0;
+    }
+
+    n = ps2kbd_command (ch, &ps2kbd_cmd_pending, reply, 1);
+
+    for (i = 0; i < n; i++)
+    {
+        ps2kbd_reply_add (reply[i]);
+    }
+}
+
+#if PS2KBD_TX_MODE == PS2KBD_TX_MODE_DMA
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * DMA transmitter:
+ *
+ * Each byte is expanded into GPIOB->BSRR words, 4 per bit with the same timing as the interrupt transmitter:
+ *
+ *   tick 0: set data line
+ *   tick 1: clock low                  (host samples data on falling edge)
+ *   tick 2: -                          (BSRR = 0, no change)
+ *   tick 3: clock high
+ *
+ * A leading idle word keeps the data line stable for one tick after the clock edge of the previous stop bit, even
+ * if a pending DMA request is served at once when the channel is enabled. The inter-byte gap is appended as
+ * idle words, so the transfer complete interrupt comes when the next byte may start.
+ *
+ * TIM4 update requests DMA1 channel 7 every tick, which writes the next word to GPIOB->BSRR.
+ * Each byte is played in two transfers: the first one ends after the data line is set for the stop bit, the second
+ * one clocks the stop bit and plays the gap. Only these two transfer complete interrupts per byte are left, no CPU
+ * time per bit or edge. The TIM4 interrupt is only enabled while receiving a byte from the host.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define PS2_DMA_FRAME_WORDS     (1 + 4 * PS2_FRAME_BITS)                        // idle word + 4 ticks per bit
+#define PS2_DMA_WORDS           (PS2_DMA_FRAME_WORDS + PS2KBD_TX_GAP_MAX_TICKS) // frame + gap
+#define PS2_DMA_STOP_WORD       (PS2_DMA_FRAME_WORDS - 3)                       // clock low of stop bit, start of second transfer
+
+static uint32_t                 ps2kbd_dma_buffer[PS2_DMA_WORDS];
+static uint_fast8_t             ps2kbd_dma_words;                               // words of current byte including gap
+static uint_fast8_t             ps2kbd_dma_stop;                                // flag: second transfer, stop bit and gap
+
+void DMA1_Channel7_IRQHandler (void);                                           // keep compiler happy
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_dma_expand () - expand frame into BSRR words
+ *
+ * Return value: number of words including gap
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+ps2kbd_dma_expand (uint_fast16_t frame)
+{
+    uint32_t *      wp = ps2kbd_dma_buffer;
+    uint_fast8_t    gap = ps2kbd_gap_ticks;
+    uint_fast8_t    bit;
+
+    *wp++ = 0;                                                                  // idle tick
+
+    for (bit = 0; bit < PS2_FRAME_BITS; bit++)
+    {
+        *wp++ = (frame & 0x01) ? PS2_DATA_PIN : (PS2_DATA_PIN << 16);           // set or reset data
+        *wp++ = PS2_CLOCK_PIN << 16;                                            // reset clock
+        *wp++ = 0;
+        *wp++ = PS2_CLOCK_PIN;                                                  // set clock
+        frame >>= 1;
+    }
+
+    for (bit = 0; bit < gap; bit++)
+    {
+        *wp++ = 0;                                                              // inter-byte gap
+    }
+
+    return PS2_DMA_FRAME_WORDS + gap;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_tx_begin () - start sending a byte
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_tx_begin (uint_fast8_t ch)
+{
+    uint_fast8_t    words;
+
+    ps2kbd_state = PS2_STATE_TX;
+    TIM_ITConfig (TIM4, TIM_IT_Update, DISABLE);
+    words = ps2kbd_dma_expand (ps2kbd_frame_table[ch]);
+    ps2kbd_dma_words = words;
+    ps2kbd_dma_stop = 0;
+    DMA_Cmd (DMA1_Channel7, DISABLE);
+    DMA1_Channel7->CMAR = (uint32_t) ps2kbd_dma_buffer;
+    DMA_SetCurrDataCounter (DMA1_Channel7, PS2_DMA_STOP_WORD);                  // up to the stop bit, see DMA1_Channel7_IRQHandler()
+    DMA_Cmd (DMA1_Channel7, ENABLE);
+    ps2kbd_timer_start ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_rx_timer_start () - enable TIM4 interrupt for receiving
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_rx_timer_start (void)
+{
+    TIM_ClearITPendingBit (TIM4, TIM_IT_Update);
+    TIM_ITConfig (TIM4, TIM_IT_Update, ENABLE);
+    ps2kbd_timer_start ();
+}
+
+#else
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_tx_begin () - start sending a byte
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_tx_begin (uint_fast8_t ch)
+{
+    ps2kbd_state    = PS2_STATE_TX;
+    ps2kbd_frame    = ps2kbd_frame_table[ch];
+    ps2kbd_bit      = 0;
+    ps2kbd_tick     = 0;
+    ps2kbd_timer_start ();
+}
+
+#define ps2kbd_rx_timer_start()     ps2kbd_timer_start ()                       // TIM4 interrupt always enabled
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_tx_tick () - interrupt transmitter, called every tick
+ *
+ * Each bit takes 4 ticks, same timing as the former blocking bit-bang code:
+ *
+ *   tick 0: set data line
+ *   tick 1: clock low                  (host samples data on falling edge)
+ *   tick 2: -
+ *   tick 3: clock high
+ *
+ * Before each bit the clock line is sampled. If the host holds it low (inhibit), the frame is aborted.
+ * After the stop bit the transmitter waits for the inter-byte gap, counted in ps2kbd_tick.
+ *
+ * Return value: PS2_TX_BUSY, PS2_TX_DONE or PS2_TX_ABORTED
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+ps2kbd_tx_tick (void)
+{
+    uint_fast8_t    tick = ps2kbd_tick;
+
+    if (ps2kbd_bit == PS2_FRAME_BITS)                                           // stop bit sent, inter-byte gap
+    {
+        ps2kbd_tick++;
+        return (ps2kbd_tick >= ps2kbd_gap_ticks) ? PS2_TX_DONE : PS2_TX_BUSY;
+    }
+
+    ps2kbd_tick = (tick + 1) & 0x03;
+
+    switch (tick)
+    {
+        case 0:
+        {
+            if (ps2kbd_clock_is_low ())                                         // host inhibits
+            {
+                return PS2_TX_ABORTED;
+            }
+
+            if (ps2kbd_frame & (1 << ps2kbd_bit))
+            {
+                ps2kbd_data_high ();
+            }
+            else
+            {
+                ps2kbd_data_low ();
+            }
+            break;
+        }
+        case 1:
+        {
+            ps2kbd_clock_low ();
+            break;
+        }
+        case 3:
+        {
+            ps2kbd_clock_high ();
+            ps2kbd_bit++;
+
+            if (ps2kbd_bit == PS2_FRAME_BITS && ps2kbd_gap_ticks == 0)
+            {
+                return PS2_TX_DONE;
+            }
+            break;
+        }
+    }
+
+    return PS2_TX_BUSY;
+}
+#endif
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_rx_request () - host requests to send, wait until host releases clock
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_rx_request (void)
+{
+    ps2kbd_exti_cmd (DISABLE);
+    ps2kbd_state = PS2_STATE_RX_WAIT;
+    ps2kbd_rx_timer_start ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_inhibit () - host holds clock low, wait until released
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_inhibit (void)
+{
+    ps2kbd_state            = PS2_STATE_INHIBIT;
+    ps2kbd_inhibit_ticks    = 0;
+    ps2kbd_rx_timer_start ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_tx_abort () - abort frame because host inhibits, byte is sent again after clock is released
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_tx_abort (void)
+{
+    ps2kbd_data_high ();
+    ps2kbd_clock_high ();
+    ps2kbd_retry_pending = 1;
+    ps2kbd_retry_byte = ps2kbd_last_byte;
+    ps2kbd_retry_is_reply = ps2kbd_last_is_reply;
+    ps2kbd_stats.aborts++;
+    ps2kbd_inhibit ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_next () - continue after a byte has been sent or received or a byte was queued
+ *
+ * A request to send of the host has priority. If the host inhibits, wait until clock is released. Else the next
+ * byte is sent. If there is nothing to do, TIM4 is stopped and EXTI is armed to detect the next request to send.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ps2kbd_next (void)
+{
+    uint_fast8_t    ch;
+
+    if (ps2kbd_data_is_low ())                                                  // host pulls data low: request to send
+    {
+        ps2kbd_rx_request ();
+    }
+    else if (ps2kbd_clock_is_low () && (ps2kbd_retry_pending || ps2kbd_reply_pos < ps2kbd_reply_len || ps2kbd_txsize > 0))
+    {
+        ps2kbd_inhibit ();                                                      // host inhibits, don't start a byte now
+    }
+    else if (ps2kbd_next_byte (&ch))
+    {
+        ps2kbd_tx_begin (ch);
+    }
+    else
+    {
+        TIM_Cmd (TIM4, DISABLE);
+        ps2kbd_state = PS2_STATE_IDLE;
+        ps2kbd_exti_cmd (ENABLE);
+
+        if (ps2kbd_data_is_low ())                                              // request to send while arming EXTI?
+        {
+            ps2kbd_rx_request ();
+        }
+    }
+}
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * ps2kbd_clock_low() - set clock pin to LOW
+ * ps2kbd_tx_done () - byte sent completely, go on with next one
+ *
+ * If it was the power-on BAT, the time since DWT->CYCCNT was reset by delay_init() is stored.
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 static void
-ps2kbd_clock_low ()
+ps2kbd_tx_done (void)
 {
-    GPIO_RESET_BIT (PS2_CLOCK_PORT, PS2_CLOCK_PIN);
+    if (ps2kbd_bat_pending && ps2kbd_last_is_reply && ps2kbd_last_byte == PS2KBD_REPLY_BAT_OK)
+    {
+        ps2kbd_bat_pending  = 0;
+        ps2kbd_bat_usec     = DWT->CYCCNT / (SystemCoreClock / 1000000);
+    }
+
+    ps2kbd_next ();
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * ps2kbd_clock_high() - set clock pin to HIGH
+ * ps2kbd_inhibit_tick () - wait until host releases clock, then go on after PS2_INHIBIT_RELEASE_TICKS
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 static void
-ps2kbd_clock_high ()
+ps2kbd_inhibit_tick (void)
 {
-    GPIO_SET_BIT (PS2_CLOCK_PORT, PS2_CLOCK_PIN);
+    if (ps2kbd_data_is_low ())                                                  // host wants to send a command
+    {
+        ps2kbd_state = PS2_STATE_RX_WAIT;
+    }
+    else if (ps2kbd_clock_is_low ())
+    {
+        ps2kbd_inhibit_ticks = 0;
+    }
+    else
+    {
+        ps2kbd_inhibit_ticks++;
+
+        if (ps2kbd_inhibit_ticks >= PS2_INHIBIT_RELEASE_TICKS)
+        {
+            ps2kbd_next ();
+        }
+    }
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * ps2kbd_data_low() - set data pin to LOW
+ * ps2kbd_rx_wait_tick () - wait until host releases clock after pulling data low
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 static void
-ps2kbd_data_low ()
+ps2kbd_rx_wait_tick (void)
 {
-    GPIO_RESET_BIT (PS2_DATA_PORT, PS2_DATA_PIN);
+    if (! ps2kbd_data_is_low ())                                                // host gave up
+    {
+        ps2kbd_next ();
+    }
+    else if (! ps2kbd_clock_is_low ())                                          // clock released: start bit is on the line
+    {
+        ps2kbd_state    = PS2_STATE_RX;
+        ps2kbd_frame    = 0;
+        ps2kbd_bit      = 0;
+        ps2kbd_tick     = 0;
+    }
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * ps2kbd_data_high() - set data pin to HIGH
+ * ps2kbd_rx_tick () - receiver, called every tick
+ *
+ * Device generates 11 clock pulses with 4 ticks per bit, host changes data while clock is low:
+ *
+ *   tick 0: read bit of previous clock pulse, clock is high
+ *   tick 1: clock low
+ *   tick 2: -
+ *   tick 3: clock high
+ *
+ * Pulses 0 - 9 clock in 8 data bits, parity and stop bit. After the stop bit the device pulls data low for
+ * pulse 10 (ACK bit) and releases it afterwards. If the host pulls clock low while it should be high, the
+ * reception is aborted.
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 static void
-ps2kbd_data_high ()
+ps2kbd_rx_tick (void)
 {
-    GPIO_SET_BIT (PS2_DATA_PORT, PS2_DATA_PIN);
+    uint_fast8_t    tick = ps2kbd_tick;
+
+    ps2kbd_tick = (tick + 1) & 0x03;
+
+    switch (tick)
+    {
+        case 0:
+        {
+            if (ps2kbd_clock_is_low ())                                         // host aborts
+            {
+                ps2kbd_data_high ();
+                ps2kbd_next ();
+                return;
+            }
+
+            if (ps2kbd_bit > 0 && ps2kbd_bit < PS2_FRAME_BITS)
+            {
+                if (! ps2kbd_data_is_low ())
+                {
+                    ps2kbd_frame |= 1 << (ps2kbd_bit - 1);
+                }
+            }
+
+            if (ps2kbd_bit == PS2_FRAME_BITS - 1)                               // stop bit read
+            {
+                if (ps2kbd_frame & (1 << 9))                                    // stop bit ok, send ACK bit
+                {
+                    ps2kbd_data_low ();
+                }
+                else                                                            // framing error, request resend
+                {
+                    ps2kbd_reply_add (PS2KBD_REPLY_RESEND);
+                    ps2kbd_next ();
+                    return;
+                }
+            }
+            else if (ps2kbd_bit == PS2_FRAME_BITS)                              // ACK bit sent
+            {
+                ps2kbd_data_high ();
+
+                if (__builtin_parity (ps2kbd_frame & 0x1FF))                    // odd parity ok
+                {
+                    ps2kbd_host_command (ps2kbd_frame & 0xFF);
+                }
+                else
+                {
+                    ps2kbd_reply_add (PS2KBD_REPLY_RESEND);
+                }
+
+                ps2kbd_next ();
+                return;
+            }
+            break;
+        }
+        case 1:
+        {
+            ps2kbd_clock_low ();
+            break;
+        }
+        case 3:
+        {
+            ps2kbd_clock_high ();
+            ps2kbd_bit++;
+            break;
+        }
+    }
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * ps2kbd_send_bit () - send bit
+ * TIM4_IRQHandler () - PS/2 transceiver tick
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-static void
-ps2kbd_send_bit (uint_fast8_t bitval)
+void
+TIM4_IRQHandler (void)
 {
-    if (bitval)
+    TIM_ClearITPendingBit (TIM4, TIM_IT_Update);
+
+    switch (ps2kbd_state)
+    {
+#if PS2KBD_TX_MODE == PS2KBD_TX_MODE_IRQ
+        case PS2_STATE_TX:
+        {
+            switch (ps2kbd_tx_tick ())
+            {
+                case PS2_TX_DONE:       ps2kbd_tx_done ();      break;
+                case PS2_TX_ABORTED:    ps2kbd_tx_abort ();     break;
+            }
+            break;
+        }
+#endif
+        case PS2_STATE_INHIBIT:
+        {
+            ps2kbd_inhibit_tick ();
+            break;
+        }
+        case PS2_STATE_RX_WAIT:
+        {
+            ps2kbd_rx_wait_tick ();
+            break;
+        }
+        case PS2_STATE_RX:
+        {
+            ps2kbd_rx_tick ();
+            break;
+        }
+    }
+}
+
+#if PS2KBD_TX_MODE == PS2KBD_TX_MODE_DMA
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * DMA1_Channel7_IRQHandler () - first transfer: bits 0 - 9 sent, second transfer: stop bit and gap sent
+ *
+ * The DMA transmitter can't sample the clock line before each bit. After the first transfer the data line holds the
+ * stop bit, its clock pulse is not yet sent. If the host holds the clock low now, it has inhibited during the frame
+ * and the byte is sent again. Else the stop bit is clocked: after all 11 clocks the byte counts as sent, even if the
+ * host inhibits right after it, e.g. an 8042 after each byte.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+DMA1_Channel7_IRQHandler (void)
+{
+    DMA_ClearITPendingBit (DMA1_IT_TC7);
+    DMA_Cmd (DMA1_Channel7, DISABLE);
+
+    if (ps2kbd_dma_stop)
     {
-        ps2kbd_data_high ();
+        ps2kbd_tx_done ();
+    }
+    else if (ps2kbd_clock_is_low ())                                            // host inhibited during frame
+    {
+        ps2kbd_tx_abort ();
     }
     else
     {
-        ps2kbd_data_low ();
+        ps2kbd_dma_stop = 1;
+        DMA1_Channel7->CMAR = (uint32_t) (ps2kbd_dma_buffer + PS2_DMA_STOP_WORD);
+        DMA_SetCurrDataCounter (DMA1_Channel7, ps2kbd_dma_words - PS2_DMA_STOP_WORD);
+        DMA_Cmd (DMA1_Channel7, ENABLE);
     }
-
-    delay_usec (15);
-    ps2kbd_clock_low ();
-    delay_usec (30);
-    ps2kbd_clock_high ();
-    delay_usec (15);
 }
+#endif
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * ps2kbd_send_code () - send PS/2 code
+ * EXTI15_10_IRQHandler () - host pulled data low while idle: request to send
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 void
-ps2kbd_send_code (uint_fast8_t ch)
+EXTI15_10_IRQHandler (void)
 {
-    uint_fast8_t    bit;
-    uint_fast8_t    odd_parity = 1;
+    if (EXTI_GetITStatus (PS2_DATA_EXTI_LINE) != RESET)
+    {
+        EXTI_ClearITPendingBit (PS2_DATA_EXTI_LINE);
+
+        if (ps2kbd_state == PS2_STATE_IDLE && ps2kbd_data_is_low ())
+        {
+            ps2kbd_rx_request ();
+        }
+    }
+}
 
-    ps2kbd_send_bit (0);                    // send start bit
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_key_sequence () - get make or break sequence of a key in a scan code set
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+const ps2kbd_seq_t *
+ps2kbd_key_sequence (uint_fast8_t set, uint_fast8_t key, uint_fast8_t released)
+{
+    return &ps2kbd_sequences[set - 1][key][released ? 1 : 0];
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_send_codes () - send PS/2 codes
+ *
+ * The codes are stored in the TX queue and clocked out by interrupt or DMA, so the function returns at once.
+ * It never waits: if the queue has no room for all codes, none is stored. The caller keeps its key event and
+ * tries again later, see ps2kbd_tx_free(). Interrupts are locked once per call, not per byte. Codes are dropped
+ * while the host has disabled the keyboard.
+ *
+ * Return value: 1 = codes queued or dropped, 0 = queue full
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+ps2kbd_send_codes (const uint8_t * codes, uint_fast8_t len)
+{
+    uint_fast8_t    i;
 
-    for (bit = 0; bit < 8; bit++)
+    if (! ps2kbd_enabled)
     {
-        if (ch & 0x01)
-        {
-            odd_parity++;
-            ps2kbd_send_bit (0x01);         // send data bit 1
+        return 1;
+    }
+
+    if (len > PS2KBD_TXBUFLEN - ps2kbd_txsize)                                  // free space, only grows while we copy
+    {
+        return 0;
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        ps2kbd_txbuf[ps2kbd_txstop++] = *codes++;                               // store character
+
+        if (ps2kbd_txstop >= PS2KBD_TXBUFLEN)                                   // at end of ringbuffer?
+        {                                                                       // yes
+            ps2kbd_txstop = 0;                                                  // reset to beginning
         }
-        else
+    }
+
+    __disable_irq ();                                                           // TIM4, DMA and EXTI handlers use queue
+    ps2kbd_txsize += len;                                                       // increment used size
+
+    if (ps2kbd_state == PS2_STATE_IDLE)                                         // transceiver idle?
+    {                                                                           // yes, start it
+        ps2kbd_exti_cmd (DISABLE);
+        ps2kbd_next ();
+    }
+
+    __enable_irq ();
+    return 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_send_code () - send one PS/2 code, see ps2kbd_send_codes()
+ *
+ * Return value: 1 = code queued or dropped, 0 = queue full
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+ps2kbd_send_code (uint_fast8_t ch)
+{
+    uint8_t     code = ch;
+
+    return ps2kbd_send_codes (&code, 1);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_tx_free () - get free space of TX queue
+ *
+ * Return value: number of codes ps2kbd_send_codes() takes now, the space only grows until the next call
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+ps2kbd_tx_free (void)
+{
+    return PS2KBD_TXBUFLEN - ps2kbd_txsize;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_busy () - check if transceiver is busy
+ *
+ * Return value: 1 = bytes in queue, on the wire or receiving from host, 0 = idle
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+ps2kbd_busy (void)
+{
+    return (ps2kbd_state != PS2_STATE_IDLE || ps2kbd_txsize > 0 || ps2kbd_retry_pending) ? 1 : 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_get_stats () - get transmitter counters
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+ps2kbd_get_stats (ps2kbd_stats_t * stats)
+{
+    __disable_irq ();
+    *stats = ps2kbd_stats;
+    __enable_irq ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_is_enabled () - check if keyboard is enabled by host, see PS2KBD_CMD_ENABLE, PS2KBD_CMD_DISABLE
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+ps2kbd_is_enabled (void)
+{
+    return ps2kbd_enabled;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_get_leds () - get LED state set by host, see PS2KBD_LED_xxx
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+ps2kbd_get_leds (void)
+{
+    return ps2kbd_leds;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_get_scancode_set () - get scan code set selected by host, see PS2KBD_SET_x
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+ps2kbd_get_scancode_set (void)
+{
+    return ps2kbd_scancode_set;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_get_typematic () - get typematic rate/delay byte set by host
+ *
+ * bit 0 - 4: repeat rate, 0 = 30 cps ... 31 = 2 cps
+ * bit 5 - 6: delay, 0 = 250 msec ... 3 = 1000 msec
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+ps2kbd_get_typematic (void)
+{
+    return ps2kbd_typematic;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_set_timing () - set length of tick (quarter bit) and inter-byte gap
+ *
+ * Use PS2KBD_TX_TICK_USEC_MAX_THROUGHPUT and PS2KBD_TX_GAP_TICKS_MAX_THROUGHPUT for the fastest timing within the
+ * spec, PS2KBD_TX_TICK_USEC_COMPATIBLE and PS2KBD_TX_GAP_TICKS_COMPATIBLE for slow hosts. The new tick length is
+ * loaded by TIM4 at its next update, so a byte on the wire is not disturbed.
+ *
+ * Return value: 1 = ok, 0 = values out of range
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+ps2kbd_set_timing (uint_fast8_t tick_usec, uint_fast8_t gap_ticks)
+{
+    if (tick_usec < PS2KBD_TX_TICK_MIN_USEC || tick_usec > PS2KBD_TX_TICK_MAX_USEC || gap_ticks > PS2KBD_TX_GAP_MAX_TICKS)
+    {
+        return 0;
+    }
+
+    __disable_irq ();
+    ps2kbd_tick_usec = tick_usec;
+    ps2kbd_gap_ticks = gap_ticks;
+    TIM_SetAutoreload (TIM4, tick_usec - 1);                                    // ARR is preloaded
+    __enable_irq ();
+    return 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_get_timing () - get length of tick and inter-byte gap
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+ps2kbd_get_timing (uint_fast8_t * tick_usecp, uint_fast8_t * gap_ticksp)
+{
+    *tick_usecp = ps2kbd_tick_usec;
+    *gap_ticksp = ps2kbd_gap_ticks;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_burst_test () - send a byte count times as fast as possible and measure throughput
+ *
+ * Waits until the transceiver is idle, queues all bytes and stops the DWT cycle counter when the last one is on
+ * the wire. Aborts by the host and retries are included. Choose a byte the host ignores, e.g. 0x00 in scan code
+ * set 2 (key detection error).
+ *
+ * Return value: bytes per second, 0 = keyboard disabled by host
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint32_t
+ps2kbd_burst_test (uint_fast8_t ch, uint_fast16_t count)
+{
+    uint32_t        start;
+    uint32_t        cycles;
+    uint_fast16_t   n;
+
+    if (! ps2kbd_enabled || count == 0)
+    {
+        return 0;
+    }
+
+    while (ps2kbd_busy ())
+    {
+        ;
+    }
+
+    start = DWT->CYCCNT;
+
+    for (n = 0; n < count; n++)
+    {
+        while (! ps2kbd_send_code (ch))                                         // queue full: wait, nothing else runs during the test
         {
-            ps2kbd_send_bit (0x00);         // send data bit 0
+            ;
         }
-        ch >>= 1;
     }
 
-    ps2kbd_send_bit (odd_parity & 0x01);    // send odd parity bit
-    ps2kbd_send_bit (1);                    // send stop bit
+    while (ps2kbd_busy ())
+    {
+        ;
+    }
+
+    cycles = DWT->CYCCNT - start;
+    return (uint32_t) (((uint64_t) count * SystemCoreClock) / cycles);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_uart_command () - handle host command byte received per UART
+ *
+ * Same commands as on the PS/2 data line, e.g. a host on the UART can set the LEDs or the typematic rate. The
+ * replies are not sent on the PS/2 line but stored in reply, at most PS2KBD_MAX_REPLY bytes. Replies, retries and
+ * queued scancodes of the PS/2 line stay untouched, see ps2kbd_command().
+ *
+ * Return value: number of reply bytes
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+ps2kbd_uart_command (uint_fast8_t ch, uint8_t * reply)
+{
+    uint_fast8_t    n;
+
+    __disable_irq ();                                                           // settings are shared with PS/2 ISR
+    n = ps2kbd_command (ch, &ps2kbd_uart_cmd_pending, reply, 0);
+    __enable_irq ();
+
+    if (n > 0)
+    {
+        ps2kbd_uart_last_reply = reply[n - 1];
+    }
+
+    return n;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_power_on () - send BAT completion code, call after all initialization is done
+ *
+ * 0xAA is sent before any scancode as soon as the host neither inhibits nor requests to send. The time from clock
+ * setup to the end of the frame is stored, see ps2kbd_get_bat_usec(). Startup code and SystemInit() (HSE and PLL
+ * start, 1 - 2 msec) run before and are not included.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+ps2kbd_power_on (void)
+{
+    __disable_irq ();
+    ps2kbd_bat_pending = 1;
+    ps2kbd_reply_add (PS2KBD_REPLY_BAT_OK);
+
+    if (ps2kbd_state == PS2_STATE_IDLE)
+    {
+        ps2kbd_exti_cmd (DISABLE);
+        ps2kbd_next ();
+    }
+
+    __enable_irq ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd_get_bat_usec () - get time from clock setup to end of power-on BAT
+ *
+ * Should be below PS2KBD_BAT_BUDGET_USEC.
+ *
+ * Return value: time in usec, 0 = BAT not yet sent
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint32_t
+ps2kbd_get_bat_usec (void)
+{
+    return ps2kbd_bat_usec;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
@@ -149,7 +1322,12 @@ ps2kbd_send_code (uint_fast8_t ch)
 void
 ps2kbd_init (void)
 {
-    GPIO_InitTypeDef gpio;
+    GPIO_InitTypeDef        gpio;
+    TIM_TimeBaseInitTypeDef tim;
+    NVIC_InitTypeDef        nvic;
+#if PS2KBD_TX_MODE == PS2KBD_TX_MODE_DMA
+    DMA_InitTypeDef         dma;
+#endif
 
     GPIO_StructInit (&gpio);
     RCC_APB2PeriphClockCmd (PS2_PERIPH_CLOCK_PORT, ENABLE);
@@ -166,4 +1344,57 @@ ps2kbd_init (void)
     gpio.GPIO_Speed    = GPIO_Speed_2MHz;
     GPIO_Init(PS2_DATA_PORT, &gpio);
     ps2kbd_data_high ();
+
+    RCC_APB2PeriphClockCmd (RCC_APB2Periph_AFIO, ENABLE);
+    GPIO_EXTILineConfig (PS2_DATA_PORT_SOURCE, PS2_DATA_PIN_SOURCE);
+    ps2kbd_exti_cmd (ENABLE);
+
+    RCC_APB1PeriphClockCmd (RCC_APB1Periph_TIM4, ENABLE);
+
+    TIM_TimeBaseStructInit (&tim);
+    tim.TIM_Prescaler       = (SystemCoreClock / 1000000) - 1;                  // 1 MHz
+    tim.TIM_Period          = ps2kbd_tick_usec - 1;
+    tim.TIM_ClockDivision   = TIM_CKD_DIV1;
+    tim.TIM_CounterMode     = TIM_CounterMode_Up;
+    TIM_TimeBaseInit (TIM4, &tim);
+    TIM_ARRPreloadConfig (TIM4, ENABLE);                                        // ps2kbd_set_timing() takes effect at next tick
+
+#if PS2KBD_TX_MODE == PS2KBD_TX_MODE_DMA
+    RCC_AHBPeriphClockCmd (RCC_AHBPeriph_DMA1, ENABLE);
+
+    DMA_DeInit (DMA1_Channel7);                                                 // TIM4_UP: BSRR words -> GPIOB->BSRR
+    DMA_StructInit (&dma);
+    dma.DMA_PeripheralBaseAddr  = (uint32_t) &(PS2_CLOCK_PORT->BSRR);
+    dma.DMA_MemoryBaseAddr      = (uint32_t) ps2kbd_dma_buffer;
+    dma.DMA_DIR                 = DMA_DIR_PeripheralDST;
+    dma.DMA_BufferSize          = PS2_DMA_WORDS;
+    dma.DMA_PeripheralInc       = DMA_PeripheralInc_Disable;
+    dma.DMA_MemoryInc           = DMA_MemoryInc_Enable;
+    dma.DMA_PeripheralDataSize  = DMA_PeripheralDataSize_Word;
+    dma.DMA_MemoryDataSize      = DMA_MemoryDataSize_Word;
+    dma.DMA_Mode                = DMA_Mode_Normal;
+    dma.DMA_Priority            = DMA_Priority_VeryHigh;
+    dma.DMA_M2M                 = DMA_M2M_Disable;
+    DMA_Init (DMA1_Channel7, &dma);
+    DMA_ITConfig (DMA1_Channel7, DMA_IT_TC, ENABLE);
+    TIM_DMACmd (TIM4, TIM_DMA_Update, ENABLE);
+
+    nvic.NVIC_IRQChannel                    = DMA1_Channel7_IRQn;
+    nvic.NVIC_IRQChannelPreemptionPriority  = 0;                                // PS/2 timing preempts keyboard scan and UART
+    nvic.NVIC_IRQChannelSubPriority         = 0;
+    nvic.NVIC_IRQChannelCmd                 = ENABLE;
+    NVIC_Init (&nvic);
+#else
+    TIM_ClearITPendingBit (TIM4, TIM_IT_Update);
+    TIM_ITConfig (TIM4, TIM_IT_Update, ENABLE);
+#endif
+
+    nvic.NVIC_IRQChannel                    = TIM4_IRQn;
+    nvic.NVIC_IRQChannelPreemptionPriority  = 0;                                // PS/2 timing preempts keyboard scan and UART
+    nvic.NVIC_IRQChannelSubPriority         = 0;
+    nvic.NVIC_IRQChannelCmd                 = ENABLE;
+    NVIC_Init (&nvic);
+
+    nvic.NVIC_IRQChannel                    = EXTI15_10_IRQn;
+    NVIC_Init (&nvic);
 }
@@ -27,113 +27,253 @@
  * SOFTWARE.
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-#define PS2KBD_SCANCODE_MASK    0x01FF                                                          // 512 possible key scancodes
-#define PS2KBD_EXTENDED_FLAG    0x0100
-#define PS2KBD_RELEASED_FLAG    0x0200
-
-// PS/2 scancodes SET 2
-#define PS2KBD_SCANCODE_A              0x1c
-#define PS2KBD_SCANCODE_B              0x32
-#define PS2KBD_SCANCODE_C              0x21
-#define PS2KBD_SCANCODE_D              0x23
-#define PS2KBD_SCANCODE_E              0x24
-#define PS2KBD_SCANCODE_F              0x2b
-#define PS2KBD_SCANCODE_G              0x34
-#define PS2KBD_SCANCODE_H              0x33
-#define PS2KBD_SCANCODE_I              0x43
-#define PS2KBD_SCANCODE_J              0x3b
-#define PS2KBD_SCANCODE_K              0x42
-#define PS2KBD_SCANCODE_L              0x4b
-#define PS2KBD_SCANCODE_M              0x3a
-#define PS2KBD_SCANCODE_N              0x31
-#define PS2KBD_SCANCODE_O              0x44
-#define PS2KBD_SCANCODE_P              0x4d
-#define PS2KBD_SCANCODE_Q              0x15
-#define PS2KBD_SCANCODE_R              0x2d
-#define PS2KBD_SCANCODE_S              0x1b
-#define PS2KBD_SCANCODE_T              0x2c
-#define PS2KBD_SCANCODE_U              0x3c
-#define PS2KBD_SCANCODE_V              0x2a
-#define PS2KBD_SCANCODE_W              0x1d
-#define PS2KBD_SCANCODE_X              0x22
-#define PS2KBD_SCANCODE_Y              0x35
-#define PS2KBD_SCANCODE_Z              0x1a
-#define PS2KBD_SCANCODE_0              0x45
-#define PS2KBD_SCANCODE_1              0x16
-#define PS2KBD_SCANCODE_2              0x1e
-#define PS2KBD_SCANCODE_3              0x26
-#define PS2KBD_SCANCODE_4              0x25
-#define PS2KBD_SCANCODE_5              0x2e
-#define PS2KBD_SCANCODE_6              0x36
-#define PS2KBD_SCANCODE_7              0x3d
-#define PS2KBD_SCANCODE_8              0x3e
-#define PS2KBD_SCANCODE_9              0x46
-#define PS2KBD_SCANCODE_BSP            0x66
-#define PS2KBD_SCANCODE_SPACE          0x29
-#define PS2KBD_SCANCODE_TAB            0x0D
-#define PS2KBD_SCANCODE_CAPS           0x58
-#define PS2KBD_SCANCODE_LSHFT          0x12
-#define PS2KBD_SCANCODE_RSHFT          0x59
-#define PS2KBD_SCANCODE_LCTRL          0x14
-#define PS2KBD_SCANCODE_RCTRL          (0x14 | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_LALT           0x11
-#define PS2KBD_SCANCODE_RALT           (0x11 | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_LWIN           (0x1F | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_RWIN           (0x27 | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_MENU           (0x2F | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_ENTER          0x5A
-#define PS2KBD_SCANCODE_ESC            0x76
-#define PS2KBD_SCANCODE_F1             0x05
-#define PS2KBD_SCANCODE_F2             0x06
-#define PS2KBD_SCANCODE_F3             0x04
-#define PS2KBD_SCANCODE_F4             0x0C
-#define PS2KBD_SCANCODE_F5             0x03
-#define PS2KBD_SCANCODE_F6             0x0B
-#define PS2KBD_SCANCODE_F7             0x83
-#define PS2KBD_SCANCODE_F8             0x0A
-#define PS2KBD_SCANCODE_F9             0x01
-#define PS2KBD_SCANCODE_F10            0x09
-#define PS2KBD_SCANCODE_F11            0x78
-#define PS2KBD_SCANCODE_F12            0x07
-#define PS2KBD_SCANCODE_SCROLL         0x7E
-#define PS2KBD_SCANCODE_INSERT         (0x70 | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_HOME           (0x6C | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_PG_UP          (0x7D | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_DELETE         (0x71 | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_END            (0x69 | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_PG_DN          (0x7A | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_U_ARROW        (0x75 | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_L_ARROW        (0x6B | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_D_ARROW        (0x72 | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_R_ARROW        (0x74 | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_NUM            0x77
-#define PS2KBD_SCANCODE_KP_SLASH       (0x4A | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_KP_ASTERISK    0x7C
-#define PS2KBD_SCANCODE_KP_MINUS       0x7B
-#define PS2KBD_SCANCODE_KP_PLUS        0x79
-#define PS2KBD_SCANCODE_KP_ENTER       (0x5A | PS2KEY_EXTENDED_FLAG)
-#define PS2KBD_SCANCODE_KP_COMMA       0x71
-#define PS2KBD_SCANCODE_KP_0           0x70
-#define PS2KBD_SCANCODE_KP_1           0x69
-#define PS2KBD_SCANCODE_KP_2           0x72
-#define PS2KBD_SCANCODE_KP_3           0x7A
-#define PS2KBD_SCANCODE_KP_4           0x6B
-#define PS2KBD_SCANCODE_KP_5           0x73
-#define PS2KBD_SCANCODE_KP_6           0x74
-#define PS2KBD_SCANCODE_KP_7           0x6C
-#define PS2KBD_SCANCODE_KP_8           0x75
-#define PS2KBD_SCANCODE_KP_9           0x7D
-
-#define PS2KBD_SCANCODE_SHARP_S        0x4E
-#define PS2KBD_SCANCODE_U_UMLAUT       0x54
-#define PS2KBD_SCANCODE_O_UMLAUT       0x4C
-#define PS2KBD_SCANCODE_A_UMLAUT       0x52
-#define PS2KBD_SCANCODE_PLUS           0x5B
-#define PS2KBD_SCANCODE_HASH           0x5D
-#define PS2KBD_SCANCODE_MINUS          0x4A
-#define PS2KBD_SCANCODE_DOT            0x49
-#define PS2KBD_SCANCODE_COMMA          0x41
-#define PS2KBD_SCANCODE_LESS           0x61
-
-extern void     ps2kbd_send_code (uint_fast8_t ch);
-extern void     ps2kbd_init (void);
+#ifndef PS2KBD_H
+#define PS2KBD_H
+
+#include <stdint.h>
+
+#define PS2KBD_EXTENDED_FLAG    0x0100                                                          // code is sent with E0 prefix
+#define PS2KBD_E0(c)            ((c) | PS2KBD_EXTENDED_FLAG)
+
+/* scan code sets, see PS2KBD_CMD_SCANCODE_SET */
+#define PS2KBD_SET_1            1                                                               // XT: break = make | 0x80
+#define PS2KBD_SET_2            2                                                               // AT: break = F0 make
+#define PS2KBD_SET_3            3                                                               // PS/2: no E0 prefix, break = F0 make
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * key enumeration: KEY(name, code of set 1, code of set 2, code of set 3)
+ *
+ * The names of the German keys correspond to the US keys at the same position, e.g. SHARP_S = '-', HASH = '\'.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define PS2KBD_KEY_LIST(KEY) \
+    KEY(A,           0x1E,            0x1C,            0x1C) \
+    KEY(B,           0x30,            0x32,            0x32) \
+    KEY(C,           0x2E,            0x21,            0x21) \
+    KEY(D,           0x20,            0x23,            0x23) \
+    KEY(E,           0x12,            0x24,            0x24) \
+    KEY(F,           0x21,            0x2B,            0x2B) \
+    KEY(G,           0x22,            0x34,            0x34) \
+    KEY(H,           0x23,            0x33,            0x33) \
+    KEY(I,           0x17,            0x43,            0x43) \
+    KEY(J,           0x24,            0x3B,            0x3B) \
+    KEY(K,           0x25,            0x42,            0x42) \
+    KEY(L,           0x26,            0x4B,            0x4B) \
+    KEY(M,           0x32,            0x3A,            0x3A) \
+    KEY(N,           0x31,            0x31,            0x31) \
+    KEY(O,           0x18,            0x44,            0x44) \
+    KEY(P,           0x19,            0x4D,            0x4D) \
+    KEY(Q,           0x10,            0x15,            0x15) \
+    KEY(R,           0x13,            0x2D,            0x2D) \
+    KEY(S,           0x1F,            0x1B,            0x1B) \
+    KEY(T,           0x14,            0x2C,            0x2C) \
+    KEY(U,           0x16,            0x3C,            0x3C) \
+    KEY(V,           0x2F,            0x2A,            0x2A) \
+    KEY(W,           0x11,            0x1D,            0x1D) \
+    KEY(X,           0x2D,            0x22,            0x22) \
+    KEY(Y,           0x15,            0x35,            0x35) \
+    KEY(Z,           0x2C,            0x1A,            0x1A) \
+    KEY(0,           0x0B,            0x45,            0x45) \
+    KEY(1,           0x02,            0x16,            0x16) \
+    KEY(2,           0x03,            0x1E,            0x1E) \
+    KEY(3,           0x04,            0x26,            0x26) \
+    KEY(4,           0x05,            0x25,            0x25) \
+    KEY(5,           0x06,            0x2E,            0x2E) \
+    KEY(6,           0x07,            0x36,            0x36) \
+    KEY(7,           0x08,            0x3D,            0x3D) \
+    KEY(8,           0x09,            0x3E,            0x3E) \
+    KEY(9,           0x0A,            0x46,            0x46) \
+    KEY(BSP,         0x0E,            0x66,            0x66) \
+    KEY(SPACE,       0x39,            0x29,            0x29) \
+    KEY(TAB,         0x0F,            0x0D,            0x0D) \
+    KEY(CAPS,        0x3A,            0x58,            0x14) \
+    KEY(LSHFT,       0x2A,            0x12,            0x12) \
+    KEY(RSHFT,       0x36,            0x59,            0x59) \
+    KEY(LCTRL,       0x1D,            0x14,            0x11) \
+    KEY(RCTRL,       PS2KBD_E0(0x1D), PS2KBD_E0(0x14), 0x58) \
+    KEY(LALT,        0x38,            0x11,            0x19) \
+    KEY(RALT,        PS2KBD_E0(0x38), PS2KBD_E0(0x11), 0x39) \
+    KEY(LWIN,        PS2KBD_E0(0x5B), PS2KBD_E0(0x1F), 0x8B) \
+    KEY(RWIN,        PS2KBD_E0(0x5C), PS2KBD_E0(0x27), 0x8C) \
+    KEY(MENU,        PS2KBD_E0(0x5D), PS2KBD_E0(0x2F), 0x8D) \
+    KEY(ENTER,       0x1C,            0x5A,            0x5A) \
+    KEY(ESC,         0x01,            0x76,            0x08) \
+    KEY(F1,          0x3B,            0x05,            0x07) \
+    KEY(F2,          0x3C,            0x06,            0x0F) \
+    KEY(F3,          0x3D,            0x04,            0x17) \
+    KEY(F4,          0x3E,            0x0C,            0x1F) \
+    KEY(F5,          0x3F,            0x03,            0x27) \
+    KEY(F6,          0x40,            0x0B,            0x2F) \
+    KEY(F7,          0x41,            0x83,            0x37) \
+    KEY(F8,          0x42,            0x0A,            0x3F) \
+    KEY(F9,          0x43,            0x01,            0x47) \
+    KEY(F10,         0x44,            0x09,            0x4F) \
+    KEY(F11,         0x57,            0x78,            0x56) \
+    KEY(F12,         0x58,            0x07,            0x5E) \
+    KEY(SCROLL,      0x46,            0x7E,            0x5F) \
+    KEY(INSERT,      PS2KBD_E0(0x52), PS2KBD_E0(0x70), 0x67) \
+    KEY(HOME,        PS2KBD_E0(0x47), PS2KBD_E0(0x6C), 0x6E) \
+    KEY(PG_UP,       PS2KBD_E0(0x49), PS2KBD_E0(0x7D), 0x6F) \
+    KEY(DELETE,      PS2KBD_E0(0x53), PS2KBD_E0(0x71), 0x64) \
+    KEY(END,         PS2KBD_E0(0x4F), PS2KBD_E0(0x69), 0x65) \
+    KEY(PG_DN,       PS2KBD_E0(0x51), PS2KBD_E0(0x7A), 0x6D) \
+    KEY(U_ARROW,     PS2KBD_E0(0x48), PS2KBD_E0(0x75), 0x63) \
+    KEY(L_ARROW,     PS2KBD_E0(0x4B), PS2KBD_E0(0x6B), 0x61) \
+    KEY(D_ARROW,     PS2KBD_E0(0x50), PS2KBD_E0(0x72), 0x60) \
+    KEY(R_ARROW,     PS2KBD_E0(0x4D), PS2KBD_E0(0x74), 0x6A) \
+    KEY(NUM,         0x45,            0x77,            0x76) \
+    KEY(KP_SLASH,    PS2KBD_E0(0x35), PS2KBD_E0(0x4A), 0x77) \
+    KEY(KP_ASTERISK, 0x37,            0x7C,            0x7E) \
+    KEY(KP_MINUS,    0x4A,            0x7B,            0x84) \
+    KEY(KP_PLUS,     0x4E,            0x79,            0x7C) \
+    KEY(KP_ENTER,    PS2KBD_E0(0x1C), PS2KBD_E0(0x5A), 0x79) \
+    KEY(KP_COMMA,    0x53,            0x71,            0x71) \
+    KEY(KP_0,        0x52,            0x70,            0x70) \
+    KEY(KP_1,        0x4F,            0x69,            0x69) \
+    KEY(KP_2,        0x50,            0x72,            0x72) \
+    KEY(KP_3,        0x51,            0x7A,            0x7A) \
+    KEY(KP_4,        0x4B,            0x6B,            0x6B) \
+    KEY(KP_5,        0x4C,            0x73,            0x73) \
+    KEY(KP_6,        0x4D,            0x74,            0x74) \
+    KEY(KP_7,        0x47,            0x6C,            0x6C) \
+    KEY(KP_8,        0x48,            0x75,            0x75) \
+    KEY(KP_9,        0x49,            0x7D,            0x7D) \
+    KEY(SHARP_S,     0x0C,            0x4E,            0x4E) \
+    KEY(U_UMLAUT,    0x1A,            0x54,            0x54) \
+    KEY(O_UMLAUT,    0x27,            0x4C,            0x4C) \
+    KEY(A_UMLAUT,    0x28,            0x52,            0x52) \
+    KEY(PLUS,        0x1B,            0x5B,            0x5B) \
+    KEY(HASH,        0x2B,            0x5D,            0x5C) \
+    KEY(MINUS,       0x35,            0x4A,            0x4A) \
+    KEY(DOT,         0x34,            0x49,            0x49) \
+    KEY(COMMA,       0x33,            0x41,            0x41) \
+    KEY(LESS,        0x56,            0x61,            0x13)
+
+#define PS2KBD_KEY_ENUM(name,s1,s2,s3)      PS2KBD_KEY_##name,
+
+enum
+{
+    PS2KBD_KEY_NONE = 0,                                                                        // 0 = no key
+    PS2KBD_KEY_LIST(PS2KBD_KEY_ENUM)
+    PS2KBD_KEYS
+};
+
+/* transmit modes, see PS2KBD_TX_MODE */
+#define PS2KBD_TX_MODE_IRQ             0                                                       // TIM4 interrupt per quarter bit
+#define PS2KBD_TX_MODE_DMA             1                                                       // TIM4 + DMA plays precomputed GPIO waveform
+
+#ifndef PS2KBD_TX_MODE
+#define PS2KBD_TX_MODE                 PS2KBD_TX_MODE_IRQ
+#endif
+
+#define PS2KBD_TXBUFLEN                32                                                      // size of TX queue
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * bit timing: one tick = quarter bit, gap = extra idle ticks after the stop bit of each byte
+ *
+ * The clock line stays high for (gap + 2) ticks between two bytes, the host expects at least 50 usec.
+ * Both values can be changed at runtime, see ps2kbd_set_timing().
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define PS2KBD_TX_TICK_MIN_USEC        15                                                      // 60 usec per bit = 16.7 kHz, top of spec
+#define PS2KBD_TX_TICK_MAX_USEC        25                                                      // 100 usec per bit = 10 kHz, bottom of spec
+#define PS2KBD_TX_GAP_MAX_TICKS        32                                                      // upper limit of inter-byte gap
+
+/* timing profiles */
+#define PS2KBD_TX_TICK_USEC_MAX_THROUGHPUT  15                                                 // 16.7 kHz
+#define PS2KBD_TX_GAP_TICKS_MAX_THROUGHPUT  2                                                  // clock high for 4 x 15 = 60 usec between bytes
+#define PS2KBD_TX_TICK_USEC_COMPATIBLE      20                                                 // 12.5 kHz
+#define PS2KBD_TX_GAP_TICKS_COMPATIBLE      8                                                  // clock high for 10 x 20 = 200 usec between bytes
+
+#ifndef PS2KBD_TX_TICK_USEC
+#define PS2KBD_TX_TICK_USEC            PS2KBD_TX_TICK_USEC_MAX_THROUGHPUT
+#endif
+
+#ifndef PS2KBD_TX_GAP_TICKS
+#define PS2KBD_TX_GAP_TICKS            PS2KBD_TX_GAP_TICKS_MAX_THROUGHPUT
+#endif
+
+#if PS2KBD_TX_TICK_USEC < PS2KBD_TX_TICK_MIN_USEC || PS2KBD_TX_TICK_USEC > PS2KBD_TX_TICK_MAX_USEC
+#error PS2KBD_TX_TICK_USEC out of range
+#endif
+
+#if PS2KBD_TX_GAP_TICKS > PS2KBD_TX_GAP_MAX_TICKS
+#error PS2KBD_TX_GAP_TICKS out of range
+#endif
+
+#define PS2KBD_BAT_BUDGET_USEC         10000                                                   // max. time from clock setup to end of power-on BAT
+#define PS2KBD_BAT_REPORT              0                                                       // 1 = print BAT time at startup, see ps2kbd_get_bat_usec()
+
+#define PS2KBD_BURST_TEST              0                                                       // 1 = measure throughput at startup, see ps2kbd_burst_test()
+#define PS2KBD_BURST_TEST_BYTES        256                                                     // number of bytes sent by burst test
+
+/* host commands */
+#define PS2KBD_CMD_SCANCODE_SET        0xF0                                                    // + argument: 0 = get, 1 - 3 = set
+#define PS2KBD_CMD_SET_LEDS            0xED                                                    // + argument: LED bits
+#define PS2KBD_CMD_ECHO                0xEE
+#define PS2KBD_CMD_READ_ID             0xF2
+#define PS2KBD_CMD_TYPEMATIC           0xF3                                                    // + argument: rate/delay
+#define PS2KBD_CMD_ENABLE              0xF4
+#define PS2KBD_CMD_DISABLE             0xF5
+#define PS2KBD_CMD_DEFAULTS            0xF6
+#define PS2KBD_CMD_RESEND              0xFE
+#define PS2KBD_CMD_RESET               0xFF
+
+/* replies to host */
+#define PS2KBD_REPLY_BAT_OK            0xAA
+#define PS2KBD_REPLY_ECHO              0xEE
+#define PS2KBD_REPLY_ACK               0xFA
+#define PS2KBD_REPLY_RESEND            0xFE
+#define PS2KBD_REPLY_ID1               0xAB
+#define PS2KBD_REPLY_ID2               0x83
+
+/* LED bits, see PS2KBD_CMD_SET_LEDS */
+#define PS2KBD_LED_SCROLL_LOCK         0x01
+#define PS2KBD_LED_NUM_LOCK            0x02
+#define PS2KBD_LED_CAPS_LOCK           0x04
+
+#define PS2KBD_TYPEMATIC_DEFAULT       0x2B                                                    // 500 msec delay, 10.9 cps
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * transmitter counters, see ps2kbd_get_stats()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    uint32_t            aborts;                                                 // frames aborted because host inhibited
+    uint32_t            retries;                                                // aborted bytes sent again
+    uint32_t            resends;                                                // resend requests (FE) of host
+} ps2kbd_stats_t;
+
+#define PS2KBD_MAX_CODES               3                                                       // max. length of make or break sequence
+#define PS2KBD_MAX_REPLY               3                                                       // max. number of reply bytes to a host command
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * complete make or break sequence of a key, see ps2kbd_key_sequence()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    uint8_t             len;                                                    // number of codes, 0 = PS2KBD_KEY_NONE
+    uint8_t             codes[PS2KBD_MAX_CODES];                                // E0, F0 prefixes included
+} ps2kbd_seq_t;
+
+extern const ps2kbd_seq_t * ps2kbd_key_sequence (uint_fast8_t set, uint_fast8_t key, uint_fast8_t released);
+extern uint_fast8_t     ps2kbd_send_code (uint_fast8_t ch);
+extern uint_fast8_t     ps2kbd_send_codes (const uint8_t * codes, uint_fast8_t len);
+extern uint_fast8_t     ps2kbd_tx_free (void);
+extern uint_fast8_t     ps2kbd_busy (void);
+extern void             ps2kbd_get_stats (ps2kbd_stats_t * stats);
+extern uint_fast8_t     ps2kbd_is_enabled (void);
+extern uint_fast8_t     ps2kbd_get_leds (void);
+extern uint_fast8_t     ps2kbd_get_typematic (void);
+extern uint_fast8_t     ps2kbd_get_scancode_set (void);
+extern uint_fast8_t     ps2kbd_set_timing (uint_fast8_t tick_usec, uint_fast8_t gap_ticks);
+extern void             ps2kbd_get_timing (uint_fast8_t * tick_usecp, uint_fast8_t * gap_ticksp);
+extern uint32_t         ps2kbd_burst_test (uint_fast8_t ch, uint_fast16_t count);
+extern uint_fast8_t     ps2kbd_uart_command (uint_fast8_t ch, uint8_t * reply);
+extern void             ps2kbd_power_on (void);
+extern uint32_t         ps2kbd_get_bat_usec (void);
+extern void             ps2kbd_init (void);
+
+#endif
@@ -0,0 +1,236 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * sched.c - cooperative run-to-completion task scheduler
+ *
+ * Run-to-completion scheduler for the main loop. A task is a function without arguments that returns after a
+ * short piece of work. It becomes ready by an event flag, set with sched_post() - also from interrupt handlers -
+ * or by a deadline, set with sched_at(). Ready tasks run in order of their task id, each one to completion.
+ * If no task is ready, the idle function is called, usually sched_wait(), which sleeps with WFI until the next
+ * interrupt.
+ *
+ * Time critical work stays in interrupt handlers: matrix scan and debouncing (TIM3 or DMA), PS/2 transceiver
+ * (TIM4, DMA, EXTI) and typematic timer (TIM2). Their handlers post the tasks that process the results.
+ *
+ * Deadlines are checked after each wakeup, so their resolution is the interval of the scan interrupt (500 usec).
+ * The CPU cycles of each task are measured with the DWT cycle counter, see sched_get_stats().
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdint.h>
+
+#include "stm32f10x_conf.h"
+#include "stm32f10x.h"
+
+#include "sched.h"
+
+typedef struct
+{
+    sched_func_t        func;                                                   // task function, NULL = not added
+    uint32_t            deadline;                                               // DWT->CYCCNT value, see sched_at()
+} SCHED_TASK;
+
+static SCHED_TASK           sched_tasks[SCHED_TASKS];
+static sched_stats_t        sched_stats[SCHED_TASKS];
+static volatile uint32_t    sched_flags;                                        // bit n = task n ready, set by ISRs too
+static uint32_t             sched_deadlines;                                    // bit n = deadline of task n armed, main only
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * sched_add () - add task
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+sched_add (uint_fast8_t id, sched_func_t func)
+{
+    sched_tasks[id].func = func;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * sched_post () - set event flag of a task, can be called by interrupt handlers
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+sched_post (uint_fast8_t id)
+{
+    uint32_t    primask = __get_PRIMASK ();
+
+    __disable_irq ();                                                           // read-modify-write, handlers may nest
+    sched_flags |= 1UL << id;
+    __set_PRIMASK (primask);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * sched_at () - run task after usec, replaces a pending deadline of the task, main loop only
+ *
+ * usec must be less than half of the DWT cycle counter period (30 sec at 72 MHz). While the main loop sleeps, the
+ * task may run up to one scan interrupt period late, see sched_wait().
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+sched_at (uint_fast8_t id, uint32_t usec)
+{
+    sched_tasks[id].deadline = DWT->CYCCNT + usec * (SystemCoreClock / 1000000);
+    sched_deadlines |= 1UL << id;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * sched_due () - move expired deadlines into event flags
+ *
+ * Return value: bitmap of ready tasks
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint32_t
+sched_due (void)
+{
+    uint32_t        now     = DWT->CYCCNT;
+    uint32_t        armed   = sched_deadlines;
+    uint_fast8_t    id;
+
+    while (armed)
+    {
+        id = __builtin_ctz (armed);
+        armed &= armed - 1;
+
+        if ((int32_t) (now - sched_tasks[id].deadline) >= 0)
+        {
+            sched_deadlines &= ~(1UL << id);
+            sched_post (id);
+        }
+    }
+
+    return sched_flags;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * sched_expire () - make all armed deadlines due, main loop only
+ *
+ * Deadlines are compared within half of the DWT cycle counter period (30 sec at 72 MHz). After a sleep of
+ * unknown length, e.g. zxkbd_sleep(), they may seem to lie in the future, so their tasks are run at once and
+ * arm new ones.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+sched_expire (void)
+{
+    uint32_t        armed   = sched_deadlines;
+    uint_fast8_t    id;
+
+    sched_deadlines = 0;
+
+    while (armed)
+    {
+        id = __builtin_ctz (armed);
+        armed &= armed - 1;
+        sched_post (id);
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * sched_wait () - sleep until next interrupt, returns at once if a task is ready
+ *
+ * Interrupts are locked between the check and WFI: an interrupt in between stays pending and ends WFI at once.
+ * SysTick interrupts are switched off while sleeping, they would end WFI every few usec.
+ *
+ * No timer wakes up at the next deadline: TIM2 is typematic, TIM4 PS/2, TIM3 or TIM1 the scan engine, the other
+ * one depends on ZXKBD_SCAN_MODE. So an expired deadline is seen at the next interrupt. The scan engine raises
+ * one periodically, this bounds the latency:
+ *
+ *   ZXKBD_SCAN_MODE_TIMER: TIM3 every ZXKBD_SCAN_ROW_USEC, also on the idle fast path    ->  500 usec
+ *   ZXKBD_SCAN_MODE_DMA:   DMA1 channel 2 half transfer or transfer complete per frame  ->  4 msec, 3 msec transposed
+ *
+ * While zxkbd_sleep() has stopped the scan, no deadline is seen. idle() calls sched_expire() after wakeup.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+sched_wait (void)
+{
+    __disable_irq ();
+
+    if (! sched_due ())
+    {
+        SysTick->CTRL &= ~SysTick_CTRL_TICKINT_Msk;
+        __WFI ();
+        SysTick->CTRL |= SysTick_CTRL_TICKINT_Msk;
+    }
+
+    __enable_irq ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * sched_run () - run tasks forever, idle is called when no task is ready
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+sched_run (sched_func_t idle)
+{
+    uint32_t        ready;
+    uint32_t        start;
+    uint32_t        cycles;
+    uint_fast8_t    id;
+
+    while (1)
+    {
+        sched_due ();
+
+        __disable_irq ();
+        ready       = sched_flags;
+        sched_flags = 0;
+        __enable_irq ();
+
+        if (! ready)
+        {
+            idle ();
+            continue;
+        }
+
+        while (ready)                                                           // lowest task id first
+        {
+            id = __builtin_ctz (ready);
+            ready &= ready - 1;
+
+            if (sched_tasks[id].func)
+            {
+                start = DWT->CYCCNT;
+                (*sched_tasks[id].func) ();
+                cycles = DWT->CYCCNT - start;
+
+                sched_stats[id].runs++;
+                sched_stats[id].cycles += cycles;
+
+                if (cycles > sched_stats[id].max_cycles)
+                {
+                    sched_stats[id].max_cycles = cycles;
+                }
+            }
+        }
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * sched_get_stats () - get run counter and CPU cycles of a task
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+sched_get_stats (uint_fast8_t id, sched_stats_t * stats)
+{
+    *stats = sched_stats[id];
+}
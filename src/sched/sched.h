@@ -0,0 +1,63 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * sched.h - cooperative run-to-completion task scheduler
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+/* task ids, lower id runs first */
+#define SCHED_TASK_KEY_EVENTS   0                                               // drain key event queue, posted by scan ISR
+#define SCHED_TASK_COMBO        1                                               // send presses held back by combo stage, deadline
+#define SCHED_TASK_TYPEMATIC    2                                               // send repeated key, posted by TIM2 ISR
+#define SCHED_TASK_MACRO        3                                               // play next macro event, deadline
+#define SCHED_TASK_HOST_RX      4                                               // parse commands received per UART, deadline
+#define SCHED_TASK_LED          5                                               // update board LED, posted by key event task
+#define SCHED_TASK_CALIBRATE    6                                               // measure settle time of rows, posted at boot and per UART
+#define SCHED_TASKS             7                                               // max. 32
+
+typedef void                    (*sched_func_t) (void);
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * task counters, see sched_get_stats()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    uint32_t            runs;                                                   // number of runs
+    uint64_t            cycles;                                                 // CPU cycles of all runs
+    uint32_t            max_cycles;                                             // CPU cycles of longest run
+} sched_stats_t;
+
+extern void                     sched_add (uint_fast8_t id, sched_func_t func);
+extern void                     sched_post (uint_fast8_t id);
+extern void                     sched_at (uint_fast8_t id, uint32_t usec);
+extern void                     sched_expire (void);
+extern void                     sched_wait (void);
+extern void                     sched_run (sched_func_t idle);
+extern void                     sched_get_stats (uint_fast8_t id, sched_stats_t * stats);
+
+#endif
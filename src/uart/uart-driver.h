@@ -136,6 +136,7 @@ static volatile uint8_t             uart_rxbuf[UART_RXBUFLEN];
 static volatile uint_fast16_t       uart_rxsize = 0;                            // rx size
 
 static uint_fast8_t                 uart_rxstart = 0;                           // head, not volatile
+static uint_fast8_t                 uart_txstop  = 0;                           // tail, not volatile
 
 #define INTERRUPT_CHAR              0x03                                        // CTRL-C
 static volatile uint_fast8_t        uart_rawmode = 1;                           // raw mode: no interrupts
@@ -604,6 +605,7 @@ static volatile uint_fast8_t        uart_interrupted;
 #define UART_PREFIX_POLL            UART_CONCAT(UART_PREFIX, _poll)
 #define UART_PREFIX_RXSIZE          UART_CONCAT(UART_PREFIX, _rxsize)
 #define UART_PREFIX_FLUSH           UART_CONCAT(UART_PREFIX, _flush)
+#define UART_PREFIX_WRITE           UART_CONCAT(UART_PREFIX, _write)
 
 /*---------------------------------------------------------------------------------------------------------------------------------------------------
  * uart_init (uint32_t baudrate)
@@ -709,8 +711,8 @@ UART_PREFIX_INIT (uint32_t baudrate)
 
         // enable UART Interrupt-Vector
         nvic.NVIC_IRQChannel                    = UART_IRQ_CHANNEL;
-        nvic.NVIC_IRQChannelPreemptionPriority  = 0;
-        nvic.NVIC_IRQChannelSubPriority         = 0;
+        nvic.NVIC_IRQChannelPreemptionPriority  = 1;                            // below PS/2 timing
+        nvic.NVIC_IRQChannelSubPriority         = 1;
         nvic.NVIC_IRQChannelCmd                 = ENABLE;
         NVIC_Init (&nvic);
     }
@@ -724,8 +726,6 @@ UART_PREFIX_INIT (uint32_t baudrate)
 void
 UART_PREFIX_PUTC (uint_fast8_t ch)
 {
-    static uint_fast8_t uart_txstop  = 0;                                       // tail
-
     while (uart_txsize >= UART_TXBUFLEN)                                        // buffer full?
     {                                                                           // yes
         ;                                                                       // wait
@@ -759,6 +759,50 @@ UART_PREFIX_PUTS (const char * s)
     }
 }
 
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * uart_write () - write a block of bytes, TXE interrupt is locked once per chunk instead of once per byte
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast16_t
+UART_PREFIX_WRITE (char * p, uint_fast16_t len)
+{
+    uint_fast16_t   n = len;
+    uint_fast16_t   chunk;
+    uint_fast16_t   i;
+
+    while (n > 0)
+    {
+        while (uart_txsize >= UART_TXBUFLEN)                                    // buffer full?
+        {                                                                       // yes
+            ;                                                                   // wait
+        }
+
+        chunk = UART_TXBUFLEN - uart_txsize;                                    // free space, only grows while we copy
+
+        if (chunk > n)
+        {
+            chunk = n;
+        }
+
+        for (i = 0; i < chunk; i++)
+        {
+            uart_txbuf[uart_txstop++] = *p++;                                   // store character
+
+            if (uart_txstop >= UART_TXBUFLEN)                                   // at end of ringbuffer?
+            {                                                                   // yes
+                uart_txstop = 0;                                                // reset to beginning
+            }
+        }
+
+        USART_ITConfig(UART_NAME, USART_IT_TXE, DISABLE);                       // disable TXE interrupt
+        uart_txsize += chunk;                                                   // increment used size
+        USART_ITConfig(UART_NAME, USART_IT_TXE, ENABLE);                        // enable TXE interrupt
+        n -= chunk;
+    }
+
+    return len;
+}
+
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * uart_vprintf () - print a formatted message (by va_list)
  *-------------------------------------------------------------------------------------------------------------------------------------------
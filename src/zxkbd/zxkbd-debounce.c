@@ -0,0 +1,112 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd-debounce.c - per key debouncing of ZX keyboard matrix
+ *
+ * Each key has its own counter of consecutive samples which differ from the debounced state. The state toggles
+ * if the counter reaches the threshold. Press and release have separate thresholds:
+ *
+ *   eager mode:    press is reported on the first low sample, only the release is filtered
+ *   normal mode:   press and release are both filtered
+ *
+ * A sample is one complete frame of the scan engine, see zxkbd.c
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "zxkbd.h"
+#include "zxkbd-debounce.h"
+
+static uint_fast8_t         press_threshold;                                    // samples until press is reported
+static uint_fast8_t         release_threshold;                                  // samples until release is reported
+
+static zxkbd_bitmap_t       state;                                              // debounced state: 1 = pressed, 0 = released
+static zxkbd_bitmap_t       pending;                                            // keys with counter > 0
+static uint8_t              counter[ZXKBD_KEYS];                                // consecutive samples differing from state
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_debounce_init () - initialize debouncer
+ *
+ * press_samples:       number of equal samples until a press is reported, 1 = eager
+ * release_samples:     number of equal samples until a release is reported
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zxkbd_debounce_init (uint_fast8_t press_samples, uint_fast8_t release_samples)
+{
+    press_threshold     = press_samples   ? press_samples   : 1;
+    release_threshold   = release_samples ? release_samples : 1;
+
+    state   = 0;
+    pending = 0;
+    memset (counter, 0, sizeof (counter));
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_debounce () - feed one raw frame into debouncer, return debounced frame
+ *
+ * Only keys which differ from the debounced state or have a pending counter are visited.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+zxkbd_bitmap_t
+zxkbd_debounce (zxkbd_bitmap_t raw)
+{
+    zxkbd_bitmap_t  changed;
+    zxkbd_bitmap_t  work;
+    zxkbd_bitmap_t  mask;
+    uint_fast8_t    k;
+    uint_fast8_t    threshold;
+
+    changed = raw ^ state;
+    work    = changed | pending;
+
+    while (work)
+    {
+        k       = zxkbd_bitmap_next (&work);
+        mask    = ZXKBD_KEY_BIT(k);
+
+        if (changed & mask)
+        {
+            threshold = (state & mask) ? release_threshold : press_threshold;
+
+            if (++counter[k] >= threshold)
+            {
+                state   ^= mask;
+                pending &= ~mask;
+                counter[k] = 0;
+            }
+            else
+            {
+                pending |= mask;
+            }
+        }
+        else                                                                    // bounced back, restart counting
+        {
+            pending &= ~mask;
+            counter[k] = 0;
+        }
+    }
+
+    return state;
+}
@@ -0,0 +1,40 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd-debounce.h - per key debouncing of ZX keyboard matrix
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef ZXKBD_DEBOUNCE_H
+#define ZXKBD_DEBOUNCE_H
+
+#include <stdint.h>
+#include "zxkbd.h"
+
+#define ZXKBD_DEBOUNCE_EAGER            1                                       // 1: report press on first low sample, filter release only
+#define ZXKBD_DEBOUNCE_PRESS_SAMPLES    3                                       // samples until press is reported (if not eager)
+#define ZXKBD_DEBOUNCE_RELEASE_SAMPLES  5                                       // samples until release is reported
+
+extern void                     zxkbd_debounce_init (uint_fast8_t press_samples, uint_fast8_t release_samples);
+extern zxkbd_bitmap_t           zxkbd_debounce (zxkbd_bitmap_t raw);
+
+#endif
@@ -0,0 +1,198 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd-events.c - lock-free key event queue between scan engine and output
+ *
+ * Single producer (scan ISR), single consumer (main loop) ring buffer of key events. The producer only writes
+ * the tail index, the consumer only writes the head index, so neither side has to lock interrupts. A memory
+ * barrier makes sure that an event is stored completely before the index that publishes it.
+ *
+ * Indexes run freely and are masked by ZXKBD_EVENT_QUEUE_LEN - 1, which has to be a power of two.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdint.h>
+
+#include "stm32f10x_conf.h"
+#include "stm32f10x.h"
+
+#include "zxkbd.h"
+#include "zxkbd-events.h"
+
+#define QUEUE_MASK              (ZXKBD_EVENT_QUEUE_LEN - 1)
+
+#if ZXKBD_EVENT_QUEUE_LEN & QUEUE_MASK
+#error ZXKBD_EVENT_QUEUE_LEN must be a power of two
+#endif
+
+static zxkbd_event_t        queue[ZXKBD_EVENT_QUEUE_LEN];
+static volatile uint32_t    queue_head;                                         // next event to get, written by consumer only
+static volatile uint32_t    queue_tail;                                         // next free slot, written by producer only
+static zxkbd_event_stats_t  queue_stats;                                        // written by producer only
+
+static uint32_t             clock_cycles;                                       // DWT->CYCCNT at last call of zxkbd_events_usec()
+static uint32_t             clock_rest;                                         // cycles not yet counted as usec
+static uint32_t             clock_usec;                                         // timestamp in usec
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_events_init () - initialize event queue, call before scanning starts
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zxkbd_events_init (void)
+{
+    queue_head                  = 0;
+    queue_tail                  = 0;
+    queue_stats.overflows       = 0;
+    queue_stats.high_water      = 0;
+
+    clock_cycles                = DWT->CYCCNT;
+    clock_rest                  = 0;
+    clock_usec                  = 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_events_usec () - get timestamp in usec, producer side
+ *
+ * The DWT cycle counter wraps after 2^32 cycles (60 sec at 72 MHz), so its delta is added to a usec counter,
+ * which wraps after 71 minutes. Must be called at least once per cycle counter period, e.g. once per frame.
+ * The cycle counter does not run in STOP mode.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint32_t
+zxkbd_events_usec (void)
+{
+    uint32_t    cycles_per_usec = SystemCoreClock / 1000000;
+    uint32_t    now             = DWT->CYCCNT;
+    uint32_t    delta           = now - clock_cycles;
+
+    clock_cycles    = now;
+    clock_rest     += delta % cycles_per_usec;
+    clock_usec     += delta / cycles_per_usec;
+
+    if (clock_rest >= cycles_per_usec)
+    {
+        clock_rest -= cycles_per_usec;
+        clock_usec++;
+    }
+
+    return clock_usec;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_events_reserve () - check if n events fit into the queue, producer side
+ *
+ * The consumer only frees slots, so the events can be put afterwards without overflow.
+ *
+ * Return value: 1 = ok, 0 = not enough space, counted as overflow
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+zxkbd_events_reserve (uint_fast8_t n)
+{
+    if (queue_tail - queue_head + n > ZXKBD_EVENT_QUEUE_LEN)
+    {
+        queue_stats.overflows++;
+        return 0;
+    }
+
+    return 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_events_put () - append event, producer side
+ *
+ * Return value: 1 = ok, 0 = queue full, event dropped and counted as overflow
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+zxkbd_events_put (uint_fast8_t key, uint_fast8_t state, uint32_t usec)
+{
+    uint32_t        tail = queue_tail;
+    uint32_t        fill = tail - queue_head;
+    zxkbd_event_t * ev;
+
+    if (fill >= ZXKBD_EVENT_QUEUE_LEN)
+    {
+        queue_stats.overflows++;
+        return 0;
+    }
+
+    ev          = &queue[tail & QUEUE_MASK];
+    ev->usec    = usec;
+    ev->key     = key;
+    ev->state   = state;
+
+    __DMB ();                                                                   // event complete before it is published
+    queue_tail  = tail + 1;
+
+    if (fill + 1 > queue_stats.high_water)
+    {
+        queue_stats.high_water = fill + 1;
+    }
+
+    return 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_events_get () - remove oldest event, consumer side
+ *
+ * Return value: 1 = event stored in *evp, 0 = queue empty
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+zxkbd_events_get (zxkbd_event_t * evp)
+{
+    uint32_t    head = queue_head;
+
+    if (head == queue_tail)
+    {
+        return 0;
+    }
+
+    __DMB ();                                                                   // read event after its index
+    *evp = queue[head & QUEUE_MASK];
+    __DMB ();                                                                   // slot read before it is released
+    queue_head = head + 1;
+    return 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_events_pending () - check if events are waiting, consumer side
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+zxkbd_events_pending (void)
+{
+    return queue_head != queue_tail;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_events_get_stats () - get overflow counter and high-water mark
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zxkbd_events_get_stats (zxkbd_event_stats_t * stats)
+{
+    stats->overflows    = queue_stats.overflows;                                // single 32 bit reads are atomic
+    stats->high_water   = queue_stats.high_water;
+}
@@ -0,0 +1,60 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd-events.h - lock-free key event queue between scan engine and output
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef ZXKBD_EVENTS_H
+#define ZXKBD_EVENTS_H
+
+#include <stdint.h>
+#include "zxkbd.h"
+
+#define ZXKBD_EVENT_QUEUE_LEN   64                                              // power of two, holds one frame with all keys changed
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * key event, 8 bytes
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    uint32_t            usec;                                                   // timestamp of frame, see zxkbd_events_usec()
+    uint8_t             key;                                                    // key index, see ZXKBD_KEY_INDEX()
+    uint8_t             state;                                                  // ZXKBD_KEY_PRESSED or ZXKBD_KEY_RELEASED
+} zxkbd_event_t;
+
+typedef struct
+{
+    uint32_t            overflows;                                              // events dropped or frames deferred because queue was full
+    uint32_t            high_water;                                             // max. number of events in queue
+} zxkbd_event_stats_t;
+
+extern void                     zxkbd_events_init (void);
+extern uint32_t                 zxkbd_events_usec (void);
+extern uint_fast8_t             zxkbd_events_reserve (uint_fast8_t n);
+extern uint_fast8_t             zxkbd_events_put (uint_fast8_t key, uint_fast8_t state, uint32_t usec);
+extern uint_fast8_t             zxkbd_events_get (zxkbd_event_t * evp);
+extern uint_fast8_t             zxkbd_events_pending (void);
+extern void                     zxkbd_events_get_stats (zxkbd_event_stats_t * stats);
+
+#endif
@@ -0,0 +1,93 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd-ghost.c - ghost key detection for ZX keyboard matrix
+ *
+ * The ZX membrane has no diodes. If three keys at the corners of a rectangle in the row/column grid are held,
+ * the fourth corner reads as pressed, too. With such a rectangle it is not possible to tell which of the four keys
+ * is the phantom one, so all keys of the rectangle keep their last reported state until the pattern disappears.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdint.h>
+
+#include "zxkbd.h"
+#include "zxkbd-ghost.h"
+
+#define ROW_LANE(b,r)           ((uint_fast8_t) ((b) >> ((r) << 3)) & ZX_KBD_EXT_COLMASK)
+
+static zxkbd_bitmap_t       reported;                                           // last frame returned by zxkbd_ghost_filter()
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_ghost_init () - initialize ghost filter
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zxkbd_ghost_init (void)
+{
+    reported = 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_ghost_filter () - filter ambiguous keys of a debounced frame
+ *
+ * A rectangle exists if two rows share at least two pressed columns. Only rows with two or more pressed keys
+ * can be part of a rectangle, so frames with less than two of such rows return at once.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+zxkbd_bitmap_t
+zxkbd_ghost_filter (zxkbd_bitmap_t frame)
+{
+    uint8_t         lane[ZX_KBD_ROWS];
+    zxkbd_bitmap_t  ambiguous = 0;
+    uint_fast8_t    n_lanes = 0;
+    uint_fast8_t    row;
+    uint_fast8_t    i;
+    uint_fast8_t    j;
+    uint_fast8_t    common;
+
+    for (row = 0; row < ZX_KBD_ROWS; row++)
+    {
+        common = ROW_LANE(frame, row);
+
+        if (common & (common - 1))                                              // at least 2 keys pressed in this row
+        {
+            lane[n_lanes++] = row;
+        }
+    }
+
+    for (i = 0; i + 1 < n_lanes; i++)
+    {
+        for (j = i + 1; j < n_lanes; j++)
+        {
+            common = ROW_LANE(frame, lane[i]) & ROW_LANE(frame, lane[j]);
+
+            if (common & (common - 1))                                          // at least 2 columns in common: rectangle
+            {
+                ambiguous |= ((zxkbd_bitmap_t) common << (lane[i] << 3)) | ((zxkbd_bitmap_t) common << (lane[j] << 3));
+            }
+        }
+    }
+
+    reported = (frame & ~ambiguous) | (reported & ambiguous);
+    return reported;
+}
@@ -0,0 +1,184 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd-order.c - event ordering and rollover limit for ZX keyboard
+ *
+ * All keys changed within one frame (4 msec) are taken as simultaneous. They are sent in a fixed order, so the
+ * host sees modifiers set before and cleared after the other keys, independent of their matrix positions:
+ *
+ *   1. modifier presses
+ *   2. releases of other keys
+ *   3. presses of other keys
+ *   4. modifier releases
+ *
+ * Within each group keys are sent in key index order. The rollover limit applies to non-modifier keys: presses
+ * beyond the limit are held back. If such a key is still held when another key is released, its make code is
+ * sent then, before new presses of the same frame. A key released while held back is not sent at all.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdint.h>
+
+#include "zxkbd.h"
+#include "zxkbd-order.h"
+
+#define GROUPS                  4                                               // 0: modifier presses, 1: other releases, 2: other presses, 3: modifier releases
+
+static zxkbd_bitmap_t       modifiers;                                          // keys mapped to modifiers
+static uint_fast8_t         rollover;                                           // max. non-modifier keys, 0 = no limit
+static zxkbd_bitmap_t       reported;                                           // keys whose make code was sent
+static zxkbd_bitmap_t       pending[GROUPS];                                    // events of current frame, per group
+static uint_fast8_t         group;                                              // current group of zxkbd_order_next()
+static uint32_t             suppressed;                                         // presses held back by rollover limit
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_order_init () - initialize event ordering
+ *
+ * mods:  bitmap of keys mapped to modifiers (shift, ctrl, alt, ...)
+ * limit: ZXKBD_ROLLOVER_NKRO, ZXKBD_ROLLOVER_2KRO or ZXKBD_ROLLOVER_6KRO
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zxkbd_order_init (zxkbd_bitmap_t mods, uint_fast8_t limit)
+{
+    uint_fast8_t    i;
+
+    modifiers   = mods;
+    rollover    = limit;
+    reported    = 0;
+    suppressed  = 0;
+    group       = GROUPS;
+
+    for (i = 0; i < GROUPS; i++)
+    {
+        pending[i] = 0;
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_order_frame () - sort changes of a frame into groups, apply rollover limit
+ *
+ * The events are fetched by zxkbd_order_next() afterwards.
+ *
+ * Keys held back by the rollover limit in earlier frames and still pressed are accepted first.
+ *
+ * Return value: bitmap of keys whose reported state has changed, see zxkbd_order_reported()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+zxkbd_bitmap_t
+zxkbd_order_frame (zxkbd_bitmap_t pressed, zxkbd_bitmap_t changed)
+{
+    zxkbd_bitmap_t  last        = reported;
+    zxkbd_bitmap_t  presses     = pressed & changed;
+    zxkbd_bitmap_t  releases    = changed & ~pressed & reported;                // only keys whose make code was sent
+    zxkbd_bitmap_t  others      = presses & ~modifiers;
+    zxkbd_bitmap_t  held_back;
+    zxkbd_bitmap_t  accepted;
+    uint_fast8_t    n;
+    uint_fast8_t    key;
+
+    reported &= ~releases;
+
+    if (rollover != ZXKBD_ROLLOVER_NKRO)
+    {
+        n = __builtin_popcountll (reported & ~modifiers);                       // non-modifier keys still held
+        held_back = pressed & ~changed & ~reported & ~modifiers;
+        accepted = 0;
+
+        while (held_back && n < rollover)
+        {
+            key = zxkbd_bitmap_next (&held_back);
+            accepted |= ZXKBD_KEY_BIT(key);
+            n++;
+        }
+
+        while (others)
+        {
+            key = zxkbd_bitmap_next (&others);
+
+            if (n < rollover)
+            {
+                accepted |= ZXKBD_KEY_BIT(key);
+                n++;
+            }
+            else
+            {
+                suppressed++;
+            }
+        }
+
+        others = accepted;
+    }
+
+    pending[0]  = presses & modifiers;
+    pending[1]  = releases & ~modifiers;
+    pending[2]  = others;
+    pending[3]  = releases & modifiers;
+    group       = 0;
+
+    reported |= pending[0] | others;
+    return last ^ reported;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_order_next () - get next event of current frame
+ *
+ * Return value: 1 = key index stored in *keyp, ZXKBD_KEY_PRESSED or ZXKBD_KEY_RELEASED in *statep, 0 = no more events
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+zxkbd_order_next (uint_fast8_t * keyp, uint_fast8_t * statep)
+{
+    while (group < GROUPS && ! pending[group])
+    {
+        group++;
+    }
+
+    if (group == GROUPS)
+    {
+        return 0;
+    }
+
+    *keyp   = zxkbd_bitmap_next (&pending[group]);
+    *statep = (group == 0 || group == 2) ? ZXKBD_KEY_PRESSED : ZXKBD_KEY_RELEASED;
+    return 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_order_reported () - get bitmap of keys reported as pressed, keys held back by rollover limit are not included
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+zxkbd_bitmap_t
+zxkbd_order_reported (void)
+{
+    return reported;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_order_suppressed () - get number of presses held back by rollover limit
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint32_t
+zxkbd_order_suppressed (void)
+{
+    return suppressed;
+}
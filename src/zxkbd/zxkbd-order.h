@@ -0,0 +1,48 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd-order.h - event ordering and rollover limit for ZX keyboard
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef ZXKBD_ORDER_H
+#define ZXKBD_ORDER_H
+
+#include <stdint.h>
+#include "zxkbd.h"
+
+/* rollover limits, see ZXKBD_ROLLOVER, modifiers are not counted */
+#define ZXKBD_ROLLOVER_NKRO     0                                               // no limit
+#define ZXKBD_ROLLOVER_2KRO     2                                               // 2 keys + modifiers
+#define ZXKBD_ROLLOVER_6KRO     6                                               // 6 keys + modifiers
+
+#ifndef ZXKBD_ROLLOVER
+#define ZXKBD_ROLLOVER          ZXKBD_ROLLOVER_NKRO
+#endif
+
+extern void                     zxkbd_order_init (zxkbd_bitmap_t mods, uint_fast8_t limit);
+extern zxkbd_bitmap_t           zxkbd_order_frame (zxkbd_bitmap_t pressed, zxkbd_bitmap_t changed);
+extern uint_fast8_t             zxkbd_order_next (uint_fast8_t * keyp, uint_fast8_t * statep);
+extern zxkbd_bitmap_t           zxkbd_order_reported (void);
+extern uint32_t                 zxkbd_order_suppressed (void);
+
+#endif
@@ -0,0 +1,194 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd-typematic.c - typematic auto-repeat for ZX keyboard
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdint.h>
+
+#include "stm32f10x_conf.h"
+#include "stm32f10x.h"
+#include "stm32f10x_rcc.h"
+#include "stm32f10x_tim.h"
+#include "misc.h"
+
+#include "zxkbd.h"
+#include "zxkbd-typematic.h"
+#include "sched.h"
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * Typematic byte, same encoding as PS/2 command F3:
+ *
+ *   bit 0 - 2: A, bit 3 - 4: B     period = (8 + A) * 2^B / 240 sec     0x00 = 30 cps ... 0x1F = 2 cps
+ *   bit 5 - 6: D                   delay  = (D + 1) * 250 msec          250 ... 1000 msec
+ *
+ * TIM2 counts in steps of 100 usec. It runs only while a key is repeated: the first period is the delay, all
+ * following periods are the repeat period. The interrupt handler only flags a pending repeat for main().
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define TYPEMATIC_TICK_HZ           10000                                       // TIM2 clock, 100 usec per tick
+#define TYPEMATIC_DELAY_TICKS(t)    (((((t) >> 5) & 0x03) + 1) * (TYPEMATIC_TICK_HZ / 4))
+#define TYPEMATIC_PERIOD_TICKS(t)   ((((8 + ((t) & 0x07)) << (((t) >> 3) & 0x03)) * TYPEMATIC_TICK_HZ) / 240)
+
+#define NO_KEY                      0xFF
+
+static uint16_t                     typematic_delay;                            // delay in ticks
+static uint16_t                     typematic_period;                           // repeat period in ticks
+static uint_fast8_t                 typematic_key = NO_KEY;                     // key being repeated
+static volatile uint_fast8_t        typematic_pending;                          // flag: repeat due
+
+void TIM2_IRQHandler (void);                                                    // keep compiler happy
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * TIM2_IRQHandler () - delay or repeat period elapsed
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+TIM2_IRQHandler (void)
+{
+    TIM_ClearITPendingBit (TIM2, TIM_IT_Update);
+    TIM_SetAutoreload (TIM2, typematic_period - 1);                             // after delay: repeat period
+    typematic_pending = 1;
+    sched_post (SCHED_TASK_TYPEMATIC);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_typematic_stop () - stop repeating
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+zxkbd_typematic_stop (void)
+{
+    TIM_Cmd (TIM2, DISABLE);
+    typematic_key       = NO_KEY;
+    typematic_pending   = 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_typematic_start () - start delay of a newly pressed key
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+zxkbd_typematic_start (uint_fast8_t key)
+{
+    zxkbd_typematic_stop ();
+    typematic_key = key;
+    TIM_SetAutoreload (TIM2, typematic_delay - 1);
+    TIM_SetCounter (TIM2, 0);
+    TIM_ClearITPendingBit (TIM2, TIM_IT_Update);
+    TIM_Cmd (TIM2, ENABLE);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_typematic_set () - set delay and rate, see encoding above
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zxkbd_typematic_set (uint_fast8_t typematic)
+{
+    typematic_delay     = TYPEMATIC_DELAY_TICKS(typematic);
+    typematic_period    = TYPEMATIC_PERIOD_TICKS(typematic);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_typematic_update () - follow debounced matrix, call on every changed frame
+ *
+ * A newly pressed key becomes the repeated key and starts the delay. Releasing the repeated key stops at once.
+ * If several keys are pressed in the same frame, the one with the highest key index wins.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zxkbd_typematic_update (zxkbd_bitmap_t pressed, zxkbd_bitmap_t changed)
+{
+    zxkbd_bitmap_t  new_pressed = pressed & changed;
+    uint_fast8_t    key = NO_KEY;
+
+    while (new_pressed)
+    {
+        key = zxkbd_bitmap_next (&new_pressed);
+    }
+
+    if (key != NO_KEY)
+    {
+        zxkbd_typematic_start (key);
+    }
+    else if (typematic_key != NO_KEY && ! (pressed & ZXKBD_KEY_BIT(typematic_key)))
+    {
+        zxkbd_typematic_stop ();
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_typematic_poll () - check if repeated key has to be sent again
+ *
+ * Return value: 1 = send make code of *keyp again, 0 = nothing to do
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+zxkbd_typematic_poll (uint_fast8_t * keyp)
+{
+    if (typematic_pending)
+    {
+        typematic_pending = 0;
+
+        if (typematic_key != NO_KEY)
+        {
+            *keyp = typematic_key;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_typematic_init () - initialize typematic timer TIM2
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zxkbd_typematic_init (void)
+{
+    TIM_TimeBaseInitTypeDef     tim;
+    NVIC_InitTypeDef            nvic;
+
+    RCC_APB1PeriphClockCmd (RCC_APB1Periph_TIM2, ENABLE);
+
+    TIM_TimeBaseStructInit (&tim);
+    tim.TIM_Prescaler           = (SystemCoreClock / TYPEMATIC_TICK_HZ) - 1;    // 10 kHz
+    tim.TIM_Period              = 0xFFFF;
+    tim.TIM_ClockDivision       = TIM_CKD_DIV1;
+    tim.TIM_CounterMode         = TIM_CounterMode_Up;
+    TIM_TimeBaseInit (TIM2, &tim);
+    TIM_ARRPreloadConfig (TIM2, DISABLE);                                       // new period takes effect at once
+    TIM_ClearITPendingBit (TIM2, TIM_IT_Update);
+    TIM_ITConfig (TIM2, TIM_IT_Update, ENABLE);
+
+    nvic.NVIC_IRQChannel                    = TIM2_IRQn;
+    nvic.NVIC_IRQChannelPreemptionPriority  = 2;                                // only sets a flag
+    nvic.NVIC_IRQChannelSubPriority         = 0;
+    nvic.NVIC_IRQChannelCmd                 = ENABLE;
+    NVIC_Init (&nvic);
+
+    zxkbd_typematic_set (ZXKBD_TYPEMATIC_DEFAULT);
+    typematic_key = NO_KEY;
+}
@@ -0,0 +1,41 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd-typematic.h - typematic auto-repeat for ZX keyboard
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef ZXKBD_TYPEMATIC_H
+#define ZXKBD_TYPEMATIC_H
+
+#include <stdint.h>
+#include "zxkbd.h"
+
+#define ZXKBD_TYPEMATIC         1                                               // 1: repeat most recently pressed key
+#define ZXKBD_TYPEMATIC_DEFAULT 0x2B                                            // 500 msec delay, 10.9 cps, see zxkbd-typematic.c
+
+extern void                     zxkbd_typematic_init (void);
+extern void                     zxkbd_typematic_set (uint_fast8_t typematic);
+extern void                     zxkbd_typematic_update (zxkbd_bitmap_t pressed, zxkbd_bitmap_t changed);
+extern uint_fast8_t             zxkbd_typematic_poll (uint_fast8_t * keyp);
+
+#endif
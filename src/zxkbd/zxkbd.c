@@ -51,119 +51,926 @@
 #include "stm32f10x_dma.h"
 
 #include "delay.h"
-#include "board-led.h"
 #include "zxkbd.h"
+#include "zxkbd-debounce.h"
+#include "zxkbd-ghost.h"
+#include "zxkbd-order.h"
+#include "zxkbd-events.h"
+#include "sched.h"
 
-static uint8_t              zxkbd_matrix[ZX_KBD_ROWS];                          // keyboard matrix: 0 = pressed, 1 = released
-static uint8_t              last_zxkbd_matrix[ZX_KBD_ROWS];                     // last state of keyboard matrix
+#if ZXKBD_STROBE_COLUMNS == 1                                                   // transposed: strobe columns PB3 - PB8, read rows PA0 - PA7
+#define ZXKBD_STROBE_PORT           GPIOB
+#define ZXKBD_STROBE_MASK           0x01F8
+#define ZXKBD_STROBE_PIN(s)         (1 << ((s) + 3))
+#define ZXKBD_SENSE_PORT            GPIOA
+#define ZXKBD_SENSE_PORT_SOURCE     GPIO_PortSourceGPIOA
+#define ZXKBD_SENSE_MASK            0x00FF
+#define ZXKBD_SENSE_VALUE(idr)      ((idr) & 0x00FF)
+#define ZXKBD_STROBE_BITMAP(s,v)    zxkbd_column_bitmap ((s), (v))
+#else                                                                           // strobe rows PA0 - PA7, read columns PB3 - PB8
+#define ZXKBD_STROBE_PORT           GPIOA
+#define ZXKBD_STROBE_MASK           0x00FF
+#define ZXKBD_STROBE_PIN(s)         (1 << (s))
+#define ZXKBD_SENSE_PORT            GPIOB
+#define ZXKBD_SENSE_PORT_SOURCE     GPIO_PortSourceGPIOB
+#define ZXKBD_SENSE_MASK            0x01F8
+#define ZXKBD_SENSE_VALUE(idr)      (((idr) >> 3) & ZX_KBD_EXT_COLMASK)
+#define ZXKBD_STROBE_BITMAP(s,v)    ZXKBD_ROW_BITMAP((s), (v))
+#endif
+
+#define ZXKBD_SENSE_IDLE            ZXKBD_SENSE_VALUE(0xFFFF)                   // sense value if no key pressed
+
+static zxkbd_bitmap_t       zxkbd_last_frame;                                   // last frame captured by scan engine, used by ISR only
+static volatile uint_fast16_t zxkbd_idle_frames;                                // number of frames without any key pressed or bouncing
+
+static uint32_t             zxkbd_settle_cycles[ZXKBD_STROBES];                 // settle time of each strobe line in CPU cycles, see zxkbd_calibrate()
+static uint32_t             zxkbd_settle_cycles_max;                            // maximum of all strobe lines
+
+#if ZXKBD_STROBE_COLUMNS == 1
+#define SPREAD(n)                   (((n) & 1) | (((n) & 2) << 7) | (((n) & 4) << 14) | (((n) & 8) << 21))
+
+static const uint32_t       zxkbd_spread_nibble[16] =                           // bit n of nibble -> bit 0 of byte lane n
+{
+    SPREAD(0x0), SPREAD(0x1), SPREAD(0x2), SPREAD(0x3), SPREAD(0x4), SPREAD(0x5), SPREAD(0x6), SPREAD(0x7),
+    SPREAD(0x8), SPREAD(0x9), SPREAD(0xA), SPREAD(0xB), SPREAD(0xC), SPREAD(0xD), SPREAD(0xE), SPREAD(0xF)
+};
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_column_bitmap () - convert rows read by a column strobe (0 = pressed) into bitmap
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static zxkbd_bitmap_t
+zxkbd_column_bitmap (uint_fast8_t col, uint_fast8_t value)
+{
+    uint_fast8_t    pressed = ~value & 0xFF;
+    zxkbd_bitmap_t  bitmap;
+
+    bitmap = ((zxkbd_bitmap_t) zxkbd_spread_nibble[pressed >> 4] << 32) | zxkbd_spread_nibble[pressed & 0x0F];
+    return bitmap << col;
+}
+#endif
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * zxkbd_init() - initialize kbd port
  *
  * PA0 - PA7      8 output lines, open drain
  * PB3 - PB8      6 input columns, with pullup
+ *
+ * Transposed (ZXKBD_STROBE_COLUMNS):
+ *
+ * PB3 - PB8      6 output columns, open drain
+ * PA0 - PA7      8 input lines, with pullup
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 void
 zxkbd_init (void)
 {
     GPIO_InitTypeDef gpio;
+    uint_fast8_t     strobe;
 
-    GPIO_StructInit (&gpio);
     RCC_APB2PeriphClockCmd (RCC_APB2Periph_GPIOA, ENABLE);
+    RCC_APB2PeriphClockCmd (RCC_APB2Periph_GPIOB, ENABLE);
 
-    gpio.GPIO_Pin      = GPIO_Pin_0|GPIO_Pin_1|GPIO_Pin_2|GPIO_Pin_3|GPIO_Pin_4|GPIO_Pin_5|GPIO_Pin_6|GPIO_Pin_7;
+    GPIO_StructInit (&gpio);
+    gpio.GPIO_Pin      = ZXKBD_STROBE_MASK;
     gpio.GPIO_Mode     = GPIO_Mode_Out_OD;
     gpio.GPIO_Speed    = GPIO_Speed_2MHz;
 
-    GPIO_Init(GPIOA, &gpio);
-    GPIOA->BSRR = 0x00FF;                                   // set bits 0 - 7
+    GPIO_Init(ZXKBD_STROBE_PORT, &gpio);
+    ZXKBD_STROBE_PORT->BSRR = ZXKBD_STROBE_MASK;            // set all strobe lines
 
     GPIO_StructInit (&gpio);
-    RCC_APB2PeriphClockCmd (RCC_APB2Periph_GPIOB, ENABLE);
-
-    gpio.GPIO_Pin      = GPIO_Pin_3|GPIO_Pin_4|GPIO_Pin_5|GPIO_Pin_6|GPIO_Pin_7|GPIO_Pin_8;
+    gpio.GPIO_Pin      = ZXKBD_SENSE_MASK;
     gpio.GPIO_Mode     = GPIO_Mode_IPU;
     gpio.GPIO_Speed    = GPIO_Speed_2MHz;
 
-    GPIO_Init(GPIOB, &gpio);
+    GPIO_Init(ZXKBD_SENSE_PORT, &gpio);
 
-    memset (last_zxkbd_matrix, ZX_KBD_EXT_COLMASK, sizeof (last_zxkbd_matrix));
+    zxkbd_last_frame    = 0;
+
+    for (strobe = 0; strobe < ZXKBD_STROBES; strobe++)
+    {
+        zxkbd_settle_cycles[strobe] = DELAY_USEC_TO_CYCLES(ZXKBD_SETTLE_USEC);   // until zxkbd_calibrate() is called
+    }
+
+    zxkbd_settle_cycles_max = DELAY_USEC_TO_CYCLES(ZXKBD_SETTLE_USEC);
+
+#if ZXKBD_DEBOUNCE_EAGER == 1
+    zxkbd_debounce_init (1, ZXKBD_DEBOUNCE_RELEASE_SAMPLES);
+#else
+    zxkbd_debounce_init (ZXKBD_DEBOUNCE_PRESS_SAMPLES, ZXKBD_DEBOUNCE_RELEASE_SAMPLES);
+#endif
+    zxkbd_ghost_init ();
+    zxkbd_events_init ();
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * zxkbd_io () - read keyboard row
+ * zxkbd_sense_read () - wait settle time and read sense port, ZXKBD_OVERSAMPLE times if oversampling
+ *
+ * The reads are combined bit-parallel by a majority vote: each sample is added to a vertical 3 bit counter
+ * (one counter per port bit, bit n of c0/c1/c2 = count of bit n). A bit is 1 if it was 1 in more than half of
+ * the samples:
+ *
+ *   3 samples: count >= 2  ->  c1
+ *   5 samples: count >= 3  ->  c2 | (c1 & c0)
+ *   7 samples: count >= 4  ->  c2
+ *
+ * No branches per bit, a few instructions per sample.
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-zxkbd_io (uint_fast8_t row)
+static uint_fast16_t
+zxkbd_sense_read (uint32_t settle_cycles)
 {
-    uint8_t key;
+#if ZXKBD_OVERSAMPLE == 1
+    delay_cycles (settle_cycles);                           // wait until signals are stable, see zxkbd_calibrate()
+    return ZXKBD_SENSE_PORT->IDR;
+#elif ZXKBD_OVERSAMPLE == 3 || ZXKBD_OVERSAMPLE == 5 || ZXKBD_OVERSAMPLE == 7
+    uint_fast16_t   c0 = 0;
+    uint_fast16_t   c1 = 0;
+    uint_fast16_t   c2 = 0;
+    uint_fast16_t   sample;
+    uint_fast16_t   carry;
+    uint_fast8_t    n;
+
+    delay_cycles (settle_cycles);                           // wait until signals are stable, see zxkbd_calibrate()
 
-    last_zxkbd_matrix[row] = zxkbd_matrix[row];             // save last state
+    for (n = 0; n < ZXKBD_OVERSAMPLE; n++)
+    {
+        if (n > 0)
+        {
+            delay_cycles (DELAY_USEC_TO_CYCLES(ZXKBD_OVERSAMPLE_GAP_USEC));
+        }
+
+        sample  = ZXKBD_SENSE_PORT->IDR;
+        carry   = c0 & sample;                              // c2:c1:c0 += sample
+        c0     ^= sample;
+        c2     |= c1 & carry;
+        c1     ^= carry;
+    }
 
-    GPIOA->BRR  = 1 << row;                                 // reset one bit corresponding to addr
-    delay_usec (15);                                        // wait 15usec until signals are stable
-    key = GPIOB->IDR >> 3;                                  // read port B, shift lower 3 bits
-    GPIOA->BSRR = 0x00FF;                                   // set bits 0 - 7 again
-    zxkbd_matrix[row] = key & ZX_KBD_EXT_COLMASK;           // store lower 6 bits (5 cols + 1 extra col), 0 = key pressed, 1 = key released
+#if ZXKBD_OVERSAMPLE == 3
+    (void) c2;
+    return c1;
+#elif ZXKBD_OVERSAMPLE == 5
+    return c2 | (c1 & c0);
+#else
+    return c2;
+#endif
+
+#else
+#error ZXKBD_OVERSAMPLE must be 1, 3, 5 or 7
+#endif
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * zxkbd_row_changed () - check if row changed
+ * zxkbd_io () - read keyboard row (or column if transposed)
+ *
+ * Return value: lower 6 bits (5 cols + 1 extra col), 0 = key pressed, 1 = key released
+ *               transposed: 8 bits (rows), 0 = key pressed, 1 = key released
+ *
+ * Uses delay_cycles() for settling, so it can be called from the scan interrupt.
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 uint_fast8_t
-zxkbd_row_changed (uint_fast8_t row)
+zxkbd_io (uint_fast8_t strobe)
 {
-    uint_fast8_t    rtc;
+    uint16_t value;
+
+    ZXKBD_STROBE_PORT->BRR  = ZXKBD_STROBE_PIN(strobe);     // reset one strobe line
+    value = zxkbd_sense_read (zxkbd_settle_cycles[strobe]); // read sense lines after settle time
+    ZXKBD_STROBE_PORT->BSRR = ZXKBD_STROBE_MASK;            // set all strobe lines again
+    return ZXKBD_SENSE_VALUE(value);
+}
 
-    if (zxkbd_matrix[row] != last_zxkbd_matrix[row])
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_measure_settle () - measure settle time of one strobe line in CPU cycles, needs a key of the line held
+ *
+ * The row (or column if transposed) is pulled low and the sense lines are read repeatedly. The settle time is the
+ * time of the last change seen before the sense lines stayed stable for ZXKBD_CALIBRATE_STABLE_USEC. A slow line
+ * may read unchanged for a while before it crosses the logic threshold, so stability is only judged after a
+ * change, else the sense lines are watched for the full ZXKBD_SETTLE_MAX_USEC.
+ *
+ * Return value: settle time in CPU cycles, 0 = no change seen, e.g. no key of this row pressed
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint32_t
+zxkbd_measure_settle (uint_fast8_t strobe)
+{
+    uint32_t        start;
+    uint32_t        now;
+    uint32_t        last_change;
+    uint32_t        stable_cycles   = DELAY_USEC_TO_CYCLES(ZXKBD_CALIBRATE_STABLE_USEC);
+    uint32_t        max_cycles      = DELAY_USEC_TO_CYCLES(ZXKBD_SETTLE_MAX_USEC);
+    uint_fast16_t   last_value;
+    uint_fast16_t   value;
+    uint_fast8_t    changed         = 0;
+
+    last_value  = ZXKBD_SENSE_PORT->IDR & ZXKBD_SENSE_MASK;
+    start       = DWT->CYCCNT;
+    last_change = start;
+    ZXKBD_STROBE_PORT->BRR = ZXKBD_STROBE_PIN(strobe);                          // pull strobe line low
+
+    do
     {
-        rtc = 1;
-    }
-    else
+        value   = ZXKBD_SENSE_PORT->IDR & ZXKBD_SENSE_MASK;
+        now     = DWT->CYCCNT;
+
+        if (value != last_value)
+        {
+            last_value  = value;
+            last_change = now;
+            changed     = 1;
+        }
+    } while ((uint32_t) (now - start) < max_cycles && (! changed || (uint32_t) (now - last_change) < stable_cycles));
+
+    ZXKBD_STROBE_PORT->BSRR = ZXKBD_STROBE_MASK;                                // release strobe line
+    delay_cycles (max_cycles);                                                  // let sense lines recover before next run
+
+    return last_change - start;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_pin_mode () - set mode of port pins, e.g. ZXKBD_PIN_OUT_OD, with two register writes
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define ZXKBD_PIN_OUT_OD            0x06                                        // CNF = 01, MODE = 10: output open drain, 2 MHz
+#define ZXKBD_PIN_IN_PULL           0x08                                        // CNF = 10, MODE = 00: input with pullup (ODR = 1)
+
+static void
+zxkbd_pin_mode (GPIO_TypeDef * port, uint_fast16_t pins, uint32_t mode)
+{
+    uint32_t        crl = port->CRL;
+    uint32_t        crh = port->CRH;
+    uint_fast8_t    pin;
+
+    for (pin = 0; pin < 8; pin++)
     {
-        rtc = 0;
+        if (pins & (1 << pin))
+        {
+            crl = (crl & ~(0x0FUL << (4 * pin))) | (mode << (4 * pin));
+        }
+
+        if (pins & (1 << (pin + 8)))
+        {
+            crh = (crh & ~(0x0FUL << (4 * pin))) | (mode << (4 * pin));
+        }
     }
 
-    return rtc;
+    port->CRL = crl;
+    port->CRH = crh;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * zxkbd_key_state () - return state of a row/column
+ * zxkbd_measure_recovery () - measure time lines parked low need to rise through their pullups, no key needed
+ *
+ * The lines are pulled low as outputs, then switched to inputs with pullup and read until all of them are high.
+ * The lines are left as inputs with pullup.
  *
- * Return values:
- *  ZXKBD_KEY_NOCHANGE          - no change
- *  ZXKBD_KEY_PRESSED           - key pressed
- *  ZXKBD_KEY_RELEASED          - key released
+ * Return value: recovery time in CPU cycles, at most ZXKBD_SETTLE_MAX_USEC
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint32_t
+zxkbd_measure_recovery (GPIO_TypeDef * port, uint_fast16_t pins)
+{
+    uint32_t        start;
+    uint32_t        now;
+    uint32_t        max_cycles = DELAY_USEC_TO_CYCLES(ZXKBD_SETTLE_MAX_USEC);
+
+    port->BRR = pins;
+    zxkbd_pin_mode (port, pins, ZXKBD_PIN_OUT_OD);                              // park lines low
+    delay_cycles (DELAY_USEC_TO_CYCLES(ZXKBD_SETTLE_MIN_USEC));
+
+    port->BSRR = pins;                                                          // ODR = 1: pullup as soon as input
+    zxkbd_pin_mode (port, pins, ZXKBD_PIN_IN_PULL);
+    start = DWT->CYCCNT;
+
+    do
+    {
+        now = DWT->CYCCNT;
+    } while ((port->IDR & pins) != pins && (uint32_t) (now - start) < max_cycles);
+
+    return now - start;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_calibrate () - measure settle time of each row (column), called by a scheduler task at boot or on demand
+ *
+ * Two measurements per strobe line, each ZXKBD_CALIBRATE_RUNS times:
+ *
+ *   - recovery: the sense lines and the strobe line are parked low and released to their pullups, no key needs
+ *     to be held. After a key of the previous strobe line was released, the sense pullup has to charge the wires
+ *     of both lines, so the sum of both recovery times is taken. This covers long cables.
+ *   - settle: if a key of the strobe line is held, the time until the sense lines are stable is measured, too.
+ *
+ * The worst case is doubled and limited to ZXKBD_SETTLE_MIN_USEC ... ZXKBD_SETTLE_MAX_USEC. Scanning is paused
+ * during calibration, it takes about 2 x ZXKBD_SETTLE_MAX_USEC per run and strobe line without keys held.
+ *
+ * DMA scan mode: TIM1 is stopped in the middle of a row slot. CC1 is preloaded, see zxkbd_scan_start(), so the new
+ * settle time takes effect at the next update event: a compare event is neither lost nor doubled in the current
+ * slot, which would shift the capture buffer against the row patterns. The row of the current slot is selected
+ * again before TIM1 goes on.
+ *
+ * Return value: maximum settle time of all rows in usec
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 uint_fast8_t
-zxkbd_key_state (uint_fast8_t row, uint_fast8_t col)
+zxkbd_calibrate (void)
+{
+    uint32_t        min_cycles = DELAY_USEC_TO_CYCLES(ZXKBD_SETTLE_MIN_USEC);
+    uint32_t        max_cycles = DELAY_USEC_TO_CYCLES(ZXKBD_SETTLE_MAX_USEC);
+    uint32_t        sense_cycles = 0;
+    uint32_t        worst;
+    uint32_t        cycles;
+    uint32_t        all_max = 0;
+    uint_fast8_t    strobe;
+    uint_fast8_t    run;
+
+#if ZXKBD_SCAN_MODE == ZXKBD_SCAN_MODE_TIMER
+    NVIC_DisableIRQ (TIM3_IRQn);
+#else
+    uint_fast8_t    tim_enabled = (TIM1->CR1 & TIM_CR1_CEN) ? 1 : 0;
+    TIM_Cmd (TIM1, DISABLE);
+#endif
+
+    ZXKBD_STROBE_PORT->BSRR = ZXKBD_STROBE_MASK;                                // all strobe lines high
+    delay_cycles (max_cycles);
+
+    for (run = 0; run < ZXKBD_CALIBRATE_RUNS; run++)                            // sense lines are inputs with pullup anyway
+    {
+        cycles = zxkbd_measure_recovery (ZXKBD_SENSE_PORT, ZXKBD_SENSE_MASK);
+
+        if (sense_cycles < cycles)
+        {
+            sense_cycles = cycles;
+        }
+    }
+
+    for (strobe = 0; strobe < ZXKBD_STROBES; strobe++)
+    {
+        worst = 0;
+
+        for (run = 0; run < ZXKBD_CALIBRATE_RUNS; run++)
+        {
+            cycles = sense_cycles + zxkbd_measure_recovery (ZXKBD_STROBE_PORT, ZXKBD_STROBE_PIN(strobe));
+            zxkbd_pin_mode (ZXKBD_STROBE_PORT, ZXKBD_STROBE_PIN(strobe), ZXKBD_PIN_OUT_OD);  // ODR = 1: released
+
+            if (worst < cycles)
+            {
+                worst = cycles;
+            }
+
+            cycles = zxkbd_measure_settle (strobe);
+
+            if (worst < cycles)
+            {
+                worst = cycles;
+            }
+        }
+
+        cycles = 2 * worst;                                                     // safety margin
+
+        if (cycles < min_cycles)
+        {
+            cycles = min_cycles;
+        }
+        else if (cycles > max_cycles)
+        {
+            cycles = max_cycles;
+        }
+
+        zxkbd_settle_cycles[strobe] = cycles;
+
+        if (all_max < cycles)
+        {
+            all_max = cycles;
+        }
+    }
+
+    zxkbd_settle_cycles_max = all_max;
+
+#if ZXKBD_SCAN_MODE == ZXKBD_SCAN_MODE_TIMER
+    NVIC_EnableIRQ (TIM3_IRQn);
+#else
+    TIM_SetCompare1 (TIM1, (all_max + DELAY_USEC_TO_CYCLES(1) - 1) / DELAY_USEC_TO_CYCLES(1));  // preloaded: used from next row on
+
+    if (tim_enabled)
+    {
+        strobe = (2 * ZXKBD_STROBES - 1 - DMA_GetCurrDataCounter (DMA1_Channel5)) % ZXKBD_STROBES;  // last row pattern written
+        ZXKBD_STROBE_PORT->BRR = ZXKBD_STROBE_PIN(strobe);                      // select row of current slot again
+        TIM_Cmd (TIM1, ENABLE);
+    }
+#endif
+
+    return (all_max + DELAY_USEC_TO_CYCLES(1) - 1) / DELAY_USEC_TO_CYCLES(1);
+}
+
+#if ZXKBD_SCAN_MODE == ZXKBD_SCAN_MODE_TIMER && ZXKBD_IDLE_FAST_PATH == 1
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_io_all () - read sense lines with all strobe lines low at once
+ *
+ * Return value: ZXKBD_SENSE_IDLE if no key is pressed
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+zxkbd_io_all (void)
+{
+    uint16_t value;
+
+    ZXKBD_STROBE_PORT->BRR  = ZXKBD_STROBE_MASK;            // all strobe lines low
+    value = zxkbd_sense_read (zxkbd_settle_cycles_max);     // read sense lines after settle time
+    ZXKBD_STROBE_PORT->BSRR = ZXKBD_STROBE_MASK;            // set all strobe lines again
+    return ZXKBD_SENSE_VALUE(value);
+}
+#endif
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_frame_complete () - debounce a complete frame and compare it with the previous one, called by scan ISR
+ *
+ * Changes are sorted by zxkbd_order_frame() and appended to the event queue, see zxkbd_events_get(). If the queue
+ * can't take all events of the frame, e.g. while the main loop waits for an inhibiting host, nothing is put and
+ * zxkbd_last_frame is kept: the changes are compared again with the next frame, so no release gets lost.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+zxkbd_frame_complete (zxkbd_bitmap_t raw)
 {
-    uint_fast8_t    colmask;
+    zxkbd_bitmap_t  frame;
+    uint32_t        usec;
+    uint_fast8_t    key;
     uint_fast8_t    state;
 
-    colmask = 1 << col;
+    usec  = zxkbd_events_usec ();                                               // called every frame to keep usec counter running
+    frame = zxkbd_debounce (raw);
+#if ZXKBD_GHOST_FILTER == 1
+    frame = zxkbd_ghost_filter (frame);                                         // hold back keys of rectangle patterns
+#endif
+
+    if (raw | frame)                                                            // key pressed or bouncing
+    {
+        zxkbd_idle_frames = 0;
+    }
+    else if (zxkbd_idle_frames < 0xFFFF)
+    {
+        zxkbd_idle_frames++;
+    }
+
+    if (frame != zxkbd_last_frame)                                              // one XOR/compare for the complete matrix
+    {
+        if (! zxkbd_events_reserve (__builtin_popcountll (frame | zxkbd_last_frame)))  // max. one event per key
+        {
+            sched_post (SCHED_TASK_KEY_EVENTS);
+            return;
+        }
+
+        (void) zxkbd_order_frame (frame, frame ^ zxkbd_last_frame);
+
+        while (zxkbd_order_next (&key, &state))
+        {
+            zxkbd_events_put (key, state, usec);
+        }
+
+        sched_post (SCHED_TASK_KEY_EVENTS);
+
+        zxkbd_last_frame    = frame;
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_idle () - check if keyboard is idle
+ *
+ * Return value: 1 = no key pressed or bouncing for ZXKBD_SLEEP_IDLE_FRAMES frames
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+zxkbd_idle (void)
+{
+    return zxkbd_idle_frames >= ZXKBD_SLEEP_IDLE_FRAMES;
+}
+
+#if ZXKBD_SCAN_MODE == ZXKBD_SCAN_MODE_TIMER
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * Timer scan engine:
+ *
+ * TIM3 runs with 1 MHz and interrupts once per row (or column if transposed). Each row is scanned at a fixed point
+ * in time, independent of how long main() is busy with sending codes. After the last row the complete frame is
+ * handed over to main().
+ *
+ * Idle fast path: in the slot of row 0 all rows are pulled low at once. If no column reads low, no key is pressed
+ * at all. Then the frame is complete after this single read and the slots of rows 1 - 7 are left idle.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static zxkbd_bitmap_t       zxkbd_scan_frame;                                   // frame in progress, used by ISR only
+static uint_fast8_t         zxkbd_scan_strobe;                                  // next row (column) to scan
+#if ZXKBD_IDLE_FAST_PATH == 1
+static uint_fast8_t         zxkbd_scan_idle;                                    // flag: no key pressed in current frame
+#endif
+
+void TIM3_IRQHandler (void);                                                    // keep compiler happy
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * TIM3_IRQHandler () - scan next row (column)
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+TIM3_IRQHandler (void)
+{
+    TIM_ClearITPendingBit (TIM3, TIM_IT_Update);
 
-    if ((zxkbd_matrix[row] & colmask) != (last_zxkbd_matrix[row] & colmask))
+#if ZXKBD_IDLE_FAST_PATH == 1
+    if (zxkbd_scan_strobe == 0)
     {
-        if (zxkbd_matrix[row] & colmask)
+        zxkbd_scan_idle = (zxkbd_io_all () == ZXKBD_SENSE_IDLE);
+
+        if (zxkbd_scan_idle)
         {
-            board_led_off ();
-            state = ZXKBD_KEY_RELEASED;
+            zxkbd_frame_complete (0);
         }
-        else
+    }
+
+    if (zxkbd_scan_idle)                                                        // nothing to do until next frame
+    {
+        zxkbd_scan_strobe++;
+
+        if (zxkbd_scan_strobe == ZXKBD_STROBES)
         {
-            board_led_on ();
-            state = ZXKBD_KEY_PRESSED;
+            zxkbd_scan_strobe = 0;
         }
+        return;
+    }
+#endif
+
+    if (zxkbd_scan_strobe == 0)
+    {
+        zxkbd_scan_frame = 0;
+    }
+
+    zxkbd_scan_frame |= ZXKBD_STROBE_BITMAP (zxkbd_scan_strobe, zxkbd_io (zxkbd_scan_strobe));
+    zxkbd_scan_strobe++;
+
+    if (zxkbd_scan_strobe == ZXKBD_STROBES)
+    {
+        zxkbd_scan_strobe = 0;
+        zxkbd_frame_complete (zxkbd_scan_frame);
     }
-    else
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_scan_start () - start timer scan engine
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zxkbd_scan_start (uint_fast16_t row_usec)
+{
+    TIM_TimeBaseInitTypeDef     tim;
+    NVIC_InitTypeDef            nvic;
+#if ZXKBD_SLEEP_MODE != ZXKBD_SLEEP_MODE_NONE
+    uint_fast8_t                pin;
+#endif
+
+    RCC_APB1PeriphClockCmd (RCC_APB1Periph_TIM3, ENABLE);
+
+    TIM_TimeBaseStructInit (&tim);
+    tim.TIM_Prescaler           = (SystemCoreClock / 1000000) - 1;              // 1 MHz, TIM3 runs with 2 x APB1 = SystemCoreClock
+    tim.TIM_Period              = row_usec - 1;
+    tim.TIM_ClockDivision       = TIM_CKD_DIV1;
+    tim.TIM_CounterMode         = TIM_CounterMode_Up;
+    TIM_TimeBaseInit (TIM3, &tim);
+
+    TIM_ClearITPendingBit (TIM3, TIM_IT_Update);
+    TIM_ITConfig (TIM3, TIM_IT_Update, ENABLE);
+
+    nvic.NVIC_IRQChannel                    = TIM3_IRQn;
+    nvic.NVIC_IRQChannelPreemptionPriority  = 1;
+    nvic.NVIC_IRQChannelSubPriority         = 0;
+    nvic.NVIC_IRQChannelCmd                 = ENABLE;
+    NVIC_Init (&nvic);
+
+#if ZXKBD_SLEEP_MODE != ZXKBD_SLEEP_MODE_NONE
+    RCC_APB2PeriphClockCmd (RCC_APB2Periph_AFIO, ENABLE);
+
+    for (pin = 0; pin < 16; pin++)
     {
-        state = ZXKBD_KEY_NOCHANGE;
+        if (ZXKBD_SENSE_MASK & (1 << pin))
+        {
+            GPIO_EXTILineConfig (ZXKBD_SENSE_PORT_SOURCE, pin);
+        }
     }
 
-    return state;
+    nvic.NVIC_IRQChannelPreemptionPriority  = 1;
+    nvic.NVIC_IRQChannelSubPriority         = 0;
+    nvic.NVIC_IRQChannelCmd                 = ENABLE;
+#if ZXKBD_STROBE_COLUMNS == 1
+    nvic.NVIC_IRQChannel                    = EXTI0_IRQn;
+    NVIC_Init (&nvic);
+    nvic.NVIC_IRQChannel                    = EXTI1_IRQn;
+    NVIC_Init (&nvic);
+    nvic.NVIC_IRQChannel                    = EXTI2_IRQn;
+    NVIC_Init (&nvic);
+#endif
+    nvic.NVIC_IRQChannel                    = EXTI3_IRQn;
+    NVIC_Init (&nvic);
+    nvic.NVIC_IRQChannel                    = EXTI4_IRQn;
+    NVIC_Init (&nvic);
+    nvic.NVIC_IRQChannel                    = EXTI9_5_IRQn;
+    NVIC_Init (&nvic);
+
+#if ZXKBD_SLEEP_MODE == ZXKBD_SLEEP_MODE_STOP
+    RCC_APB1PeriphClockCmd (RCC_APB1Periph_PWR, ENABLE);
+#endif
+#endif
+
+    zxkbd_scan_strobe = 0;
+    TIM_Cmd (TIM3, ENABLE);
+}
+
+#if ZXKBD_SLEEP_MODE != ZXKBD_SLEEP_MODE_NONE
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * Sleep mode:
+ *
+ * All rows are parked low and EXTI 3 - 8 is armed on falling edges of the columns PB3 - PB8 (transposed: all
+ * columns are parked low and EXTI 0 - 7 is armed on the rows PA0 - PA7). Then scan timer and
+ * SysTick interrupt are stopped and the MCU enters sleep (WFI) or STOP mode. A key press wakes up the MCU and
+ * the scan engine starts immediately with a full scan.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define ZXKBD_EXTI_LINES        ZXKBD_SENSE_MASK                                // EXTI line n = pin n of sense port
+
+static volatile uint_fast8_t zxkbd_wakeup;                                      // flag: woken up by key press
+
+#if ZXKBD_STROBE_COLUMNS == 1
+void EXTI0_IRQHandler (void);                                                   // keep compiler happy
+void EXTI1_IRQHandler (void);                                                   // keep compiler happy
+void EXTI2_IRQHandler (void);                                                   // keep compiler happy
+#endif
+void EXTI3_IRQHandler (void);                                                   // keep compiler happy
+void EXTI4_IRQHandler (void);                                                   // keep compiler happy
+void EXTI9_5_IRQHandler (void);                                                 // keep compiler happy
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_exti_cmd () - arm or disarm EXTI on sense lines
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+zxkbd_exti_cmd (FunctionalState state)
+{
+    EXTI_InitTypeDef    exti;
+
+    EXTI_StructInit (&exti);
+    exti.EXTI_Line      = ZXKBD_EXTI_LINES;
+    exti.EXTI_Mode      = EXTI_Mode_Interrupt;
+    exti.EXTI_Trigger   = EXTI_Trigger_Falling;
+    exti.EXTI_LineCmd   = state;
+    EXTI_Init (&exti);
+    EXTI_ClearITPendingBit (ZXKBD_EXTI_LINES);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_exti_irq () - key pressed while sleeping
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+zxkbd_exti_irq (void)
+{
+    EXTI_ClearITPendingBit (ZXKBD_EXTI_LINES);
+    zxkbd_exti_cmd (DISABLE);
+    zxkbd_wakeup = 1;
+}
+
+#if ZXKBD_STROBE_COLUMNS == 1
+void
+EXTI0_IRQHandler (void)
+{
+    zxkbd_exti_irq ();
+}
+
+void
+EXTI1_IRQHandler (void)
+{
+    zxkbd_exti_irq ();
+}
+
+void
+EXTI2_IRQHandler (void)
+{
+    zxkbd_exti_irq ();
+}
+#endif
+
+void
+EXTI3_IRQHandler (void)
+{
+    zxkbd_exti_irq ();
+}
+
+void
+EXTI4_IRQHandler (void)
+{
+    zxkbd_exti_irq ();
+}
+
+void
+EXTI9_5_IRQHandler (void)
+{
+    zxkbd_exti_irq ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_sleep () - sleep until a key is pressed or busy() returns 1
+ *
+ * Interrupts are locked between the check of the wakeup flag and WFI: an EXTI in between stays pending and ends
+ * WFI at once, same as in sched_wait(). After STOP the PLL is restarted before interrupts are unlocked, so no
+ * handler runs on HSI. busy() is checked before each sleep, e.g. ps2kbd_busy(): a host request to send wakes up
+ * the MCU, too, and the PS/2 receiver needs TIM4 running until the command is received and answered.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zxkbd_sleep (uint_fast8_t (*busy) (void))
+{
+    TIM_Cmd (TIM3, DISABLE);
+    TIM_ClearITPendingBit (TIM3, TIM_IT_Update);
+    zxkbd_scan_strobe = 0;
+
+    ZXKBD_STROBE_PORT->BRR = ZXKBD_STROBE_MASK;                                 // park all strobe lines low
+    zxkbd_wakeup    = 0;
+    zxkbd_exti_cmd (ENABLE);
+
+    delay_cycles (zxkbd_settle_cycles_max);
+
+    if (ZXKBD_SENSE_VALUE(ZXKBD_SENSE_PORT->IDR) == ZXKBD_SENSE_IDLE)           // no key pressed while arming EXTI
+    {
+        SysTick->CTRL &= ~SysTick_CTRL_TICKINT_Msk;                             // no SysTick interrupts while sleeping
+        __disable_irq ();
+
+        while (! zxkbd_wakeup && ! busy ())
+        {
+#if ZXKBD_SLEEP_MODE == ZXKBD_SLEEP_MODE_STOP
+            PWR_EnterSTOPMode (PWR_Regulator_LowPower, PWR_STOPEntry_WFI);
+            SystemInit ();                                                      // after STOP the MCU runs on HSI, restart PLL
+#else
+            __WFI ();
+#endif
+            __enable_irq ();                                                    // run handler of wakeup interrupt
+            __disable_irq ();
+        }
+
+        __enable_irq ();
+        SysTick->CTRL |= SysTick_CTRL_TICKINT_Msk;
+    }
+
+    if (! zxkbd_wakeup)                                                         // key pressed while arming EXTI or busy
+    {
+        zxkbd_exti_cmd (DISABLE);
+    }
+
+    ZXKBD_STROBE_PORT->BSRR = ZXKBD_STROBE_MASK;                                // release strobe lines
+    zxkbd_idle_frames   = 0;
+
+    TIM_Cmd (TIM3, ENABLE);
+    TIM_GenerateEvent (TIM3, TIM_EventSource_Update);                           // start scanning now, not at next slot
+}
+#endif
+
+#elif ZXKBD_SCAN_MODE == ZXKBD_SCAN_MODE_DMA
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * DMA scan engine:
+ *
+ * TIM1 runs with 1 MHz, one period per row (column if transposed):
+ *
+ *   TIM1 update    -> DMA1 channel 5: row pattern  -> GPIOA->BSRR     (pull one row low, all others high)
+ *   TIM1 CC1       -> DMA1 channel 2: GPIOB->IDR   -> capture buffer  (settle time after row select)
+ *
+ * Transposed, the pattern goes to GPIOB->BSRR and GPIOA->IDR is captured.
+ *
+ * The capture buffer holds two frames of ZXKBD_STROBES snapshots. DMA half transfer and transfer complete interrupts signal a
+ * complete frame. The interrupt handler passes the frame to zxkbd_frame_complete().
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define ZXKBD_DMA_ROW_PATTERN(s)    ((ZXKBD_STROBE_PIN(s) << 16) | (ZXKBD_STROBE_MASK & ~ZXKBD_STROBE_PIN(s)))  // BSRR: reset bit of strobe, set all others
+
+static const uint32_t       zxkbd_dma_row_pattern[ZXKBD_STROBES] =
+{
+#if ZXKBD_STROBE_COLUMNS == 1
+    ZXKBD_DMA_ROW_PATTERN(0), ZXKBD_DMA_ROW_PATTERN(1), ZXKBD_DMA_ROW_PATTERN(2), ZXKBD_DMA_ROW_PATTERN(3),
+    ZXKBD_DMA_ROW_PATTERN(4), ZXKBD_DMA_ROW_PATTERN(5)
+#else
+    ZXKBD_DMA_ROW_PATTERN(0), ZXKBD_DMA_ROW_PATTERN(1), ZXKBD_DMA_ROW_PATTERN(2), ZXKBD_DMA_ROW_PATTERN(3),
+    ZXKBD_DMA_ROW_PATTERN(4), ZXKBD_DMA_ROW_PATTERN(5), ZXKBD_DMA_ROW_PATTERN(6), ZXKBD_DMA_ROW_PATTERN(7)
+#endif
+};
+
+static volatile uint16_t    zxkbd_dma_buffer[2 * ZXKBD_STROBES];                // 2 frames of sense port IDR snapshots
+
+void DMA1_Channel2_IRQHandler (void);                                           // keep compiler happy
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_dma_check_frame () - extract sense lines of a captured frame, called by ISR
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+zxkbd_dma_check_frame (volatile uint16_t * buffer)
+{
+    zxkbd_bitmap_t  frame = 0;
+    uint_fast8_t    strobe;
+
+    for (strobe = 0; strobe < ZXKBD_STROBES; strobe++)
+    {
+        frame |= ZXKBD_STROBE_BITMAP (strobe, ZXKBD_SENSE_VALUE(buffer[strobe]));
+    }
+
+    zxkbd_frame_complete (frame);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * DMA1_Channel2_IRQHandler () - one frame captured
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+DMA1_Channel2_IRQHandler (void)
+{
+    if (DMA_GetITStatus (DMA1_IT_HT2) != RESET)
+    {
+        DMA_ClearITPendingBit (DMA1_IT_HT2);
+        zxkbd_dma_check_frame (zxkbd_dma_buffer);                               // first frame complete
+    }
+
+    if (DMA_GetITStatus (DMA1_IT_TC2) != RESET)
+    {
+        DMA_ClearITPendingBit (DMA1_IT_TC2);
+        zxkbd_dma_check_frame (zxkbd_dma_buffer + ZXKBD_STROBES);               // second frame complete
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_scan_start () - start DMA scan engine
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zxkbd_scan_start (uint_fast16_t row_usec)
+{
+    TIM_TimeBaseInitTypeDef     tim;
+    TIM_OCInitTypeDef           oc;
+    DMA_InitTypeDef             dma;
+    NVIC_InitTypeDef            nvic;
+
+    RCC_AHBPeriphClockCmd (RCC_AHBPeriph_DMA1, ENABLE);
+    RCC_APB2PeriphClockCmd (RCC_APB2Periph_TIM1, ENABLE);
+
+    DMA_DeInit (DMA1_Channel5);                                                 // TIM1_UP: row pattern -> BSRR of strobe port
+    DMA_StructInit (&dma);
+    dma.DMA_PeripheralBaseAddr  = (uint32_t) &(ZXKBD_STROBE_PORT->BSRR);
+    dma.DMA_MemoryBaseAddr      = (uint32_t) zxkbd_dma_row_pattern;
+    dma.DMA_DIR                 = DMA_DIR_PeripheralDST;
+    dma.DMA_BufferSize          = ZXKBD_STROBES;
+    dma.DMA_PeripheralInc       = DMA_PeripheralInc_Disable;
+    dma.DMA_MemoryInc           = DMA_MemoryInc_Enable;
+    dma.DMA_PeripheralDataSize  = DMA_PeripheralDataSize_Word;
+    dma.DMA_MemoryDataSize      = DMA_MemoryDataSize_Word;
+    dma.DMA_Mode                = DMA_Mode_Circular;
+    dma.DMA_Priority            = DMA_Priority_High;
+    dma.DMA_M2M                 = DMA_M2M_Disable;
+    DMA_Init (DMA1_Channel5, &dma);
+
+    DMA_DeInit (DMA1_Channel2);                                                 // TIM1_CH1: IDR of sense port -> capture buffer
+    DMA_StructInit (&dma);
+    dma.DMA_PeripheralBaseAddr  = (uint32_t) &(ZXKBD_SENSE_PORT->IDR);
+    dma.DMA_MemoryBaseAddr      = (uint32_t) zxkbd_dma_buffer;
+    dma.DMA_DIR                 = DMA_DIR_PeripheralSRC;
+    dma.DMA_BufferSize          = 2 * ZXKBD_STROBES;
+    dma.DMA_PeripheralInc       = DMA_PeripheralInc_Disable;
+    dma.DMA_MemoryInc           = DMA_MemoryInc_Enable;
+    dma.DMA_PeripheralDataSize  = DMA_PeripheralDataSize_HalfWord;
+    dma.DMA_MemoryDataSize      = DMA_MemoryDataSize_HalfWord;
+    dma.DMA_Mode                = DMA_Mode_Circular;
+    dma.DMA_Priority            = DMA_Priority_High;
+    dma.DMA_M2M                 = DMA_M2M_Disable;
+    DMA_Init (DMA1_Channel2, &dma);
+    DMA_ITConfig (DMA1_Channel2, DMA_IT_HT | DMA_IT_TC, ENABLE);
+
+    nvic.NVIC_IRQChannel                    = DMA1_Channel2_IRQn;
+    nvic.NVIC_IRQChannelPreemptionPriority  = 1;
+    nvic.NVIC_IRQChannelSubPriority         = 0;
+    nvic.NVIC_IRQChannelCmd                 = ENABLE;
+    NVIC_Init (&nvic);
+
+    TIM_TimeBaseStructInit (&tim);
+    tim.TIM_Prescaler           = (SystemCoreClock / 1000000) - 1;              // 1 MHz
+    tim.TIM_Period              = row_usec - 1;
+    tim.TIM_ClockDivision       = TIM_CKD_DIV1;
+    tim.TIM_CounterMode         = TIM_CounterMode_Up;
+    tim.TIM_RepetitionCounter   = 0;
+    TIM_TimeBaseInit (TIM1, &tim);
+
+    TIM_OCStructInit (&oc);
+    oc.TIM_OCMode               = TIM_OCMode_Timing;                            // no output, only compare event
+    oc.TIM_Pulse                = (zxkbd_settle_cycles_max + DELAY_USEC_TO_CYCLES(1) - 1) / DELAY_USEC_TO_CYCLES(1);  // DMA: one settle time for all rows
+    TIM_OC1Init (TIM1, &oc);
+    TIM_OC1PreloadConfig (TIM1, TIM_OCPreload_Enable);                          // zxkbd_calibrate() changes CC1 at update event only
+
+    DMA_Cmd (DMA1_Channel5, ENABLE);
+    DMA_Cmd (DMA1_Channel2, ENABLE);
+    TIM_DMACmd (TIM1, TIM_DMA_Update | TIM_DMA_CC1, ENABLE);
+
+    TIM_GenerateEvent (TIM1, TIM_EventSource_Update);                           // select row 0 before first compare event
+    TIM_Cmd (TIM1, ENABLE);
 }
+#endif
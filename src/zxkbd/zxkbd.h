@@ -24,19 +24,116 @@
  * SOFTWARE.
  *---------------------------------------------------------------------------------------------------------------------------------------------------
  */
+#ifndef ZXKBD_H
+#define ZXKBD_H
+
+#include <stdint.h>
+
 #define ZX_KBD_ROWS             8                                               // 8 keyboard rows
 #define ZX_KBD_COLS             5                                               // 5 keyboard columns
 #define ZX_KBD_COLMASK          0x1F                                            // lower 5 bits of byte
 #define ZX_KBD_EXT_COLS         6                                               // (5 + 1) extended keyboard columns
 #define ZX_KBD_EXT_COLMASK      0x3F                                            // lower (5 + 1) bits of byte
 
-/* return values of zxkbd_key_state() */
-#define ZXKBD_KEY_NOCHANGE      0
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * keyboard matrix as bitmap: one byte lane per row, bit 0 - 5 of each lane = columns, 1 = key pressed
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef uint64_t                zxkbd_bitmap_t;
+
+#define ZXKBD_KEYS              64                                              // size of key index space, 8 rows x 8 bits
+#define ZXKBD_KEY_INDEX(r,c)    (((r) << 3) | (c))                              // key index of row/column
+#define ZXKBD_KEY_ROW(k)        ((k) >> 3)                                      // row of key index
+#define ZXKBD_KEY_COL(k)        ((k) & 0x07)                                    // column of key index
+#define ZXKBD_KEY_BIT(k)        ((zxkbd_bitmap_t) 1 << (k))                     // bitmap bit of key index
+#define ZXKBD_ROW_BITMAP(r,v)   ((zxkbd_bitmap_t) (~(v) & ZX_KBD_EXT_COLMASK) << ((r) << 3))  // port value of row (0 = pressed) -> bitmap
+
+/* scan modes, see ZXKBD_SCAN_MODE */
+#define ZXKBD_SCAN_MODE_TIMER   0                                               // rows strobed by TIM3 interrupt
+#define ZXKBD_SCAN_MODE_DMA     1                                               // rows strobed by TIM1 + DMA, no CPU load
+
+#ifndef ZXKBD_SCAN_MODE
+#define ZXKBD_SCAN_MODE         ZXKBD_SCAN_MODE_TIMER
+#endif
+
+/* strobe direction: 0 = strobe 8 rows, read 6 columns, 1 = strobe 6 columns, read 8 rows (transposed) */
+#ifndef ZXKBD_STROBE_COLUMNS
+#define ZXKBD_STROBE_COLUMNS    0
+#endif
+
+#if ZXKBD_STROBE_COLUMNS == 1
+#define ZXKBD_STROBES           ZX_KBD_EXT_COLS                                 // 6 strobes per frame, 6 x 500 usec = 3 msec per frame
+#else
+#define ZXKBD_STROBES           ZX_KBD_ROWS                                     // 8 strobes per frame
+#endif
+
+#define ZXKBD_SCAN_ROW_USEC     500                                             // default time slot per strobe, 8 x 500 usec = 4 msec per frame
+#define ZXKBD_SETTLE_USEC       15                                              // time between row select and reading columns until calibrated
+#define ZXKBD_SETTLE_MIN_USEC   2                                               // calibration: lower limit of settle time
+#define ZXKBD_SETTLE_MAX_USEC   50                                              // calibration: upper limit of settle time
+#define ZXKBD_CALIBRATE_RUNS    8                                               // calibration: number of measurements per row
+#define ZXKBD_CALIBRATE_STABLE_USEC 2                                           // calibration: columns are settled if unchanged for this time
+#define ZXKBD_IDLE_FAST_PATH    1                                               // timer mode: 1 = read all rows at once, scan rows only if key pressed
+
+/* oversampling: number of reads per row after settle time, combined by majority vote: 1 (off), 3, 5 or 7 */
+#ifndef ZXKBD_OVERSAMPLE
+#define ZXKBD_OVERSAMPLE        3
+#endif
+
+#define ZXKBD_OVERSAMPLE_GAP_USEC   1                                           // time between two reads of the same row
+
+/* sleep modes, see ZXKBD_SLEEP_MODE, timer scan mode only */
+#define ZXKBD_SLEEP_MODE_NONE   0                                               // never sleep
+#define ZXKBD_SLEEP_MODE_WFI    1                                               // sleep mode, peripherals keep running
+#define ZXKBD_SLEEP_MODE_STOP   2                                               // STOP mode, lowest current, PLL restarted on wakeup
+
+#ifndef ZXKBD_SLEEP_MODE
+#if ZXKBD_SCAN_MODE == ZXKBD_SCAN_MODE_TIMER
+#define ZXKBD_SLEEP_MODE        ZXKBD_SLEEP_MODE_WFI
+#else
+#define ZXKBD_SLEEP_MODE        ZXKBD_SLEEP_MODE_NONE
+#endif
+#endif
+
+#define ZXKBD_SLEEP_IDLE_FRAMES 250                                             // enter sleep after 250 idle frames (1 sec with 4 msec per frame)
+
+/* key states */
 #define ZXKBD_KEY_PRESSED       1
 #define ZXKBD_KEY_RELEASED      2
 
 extern void                     zxkbd_init (void);
-extern void                     zxkbd_io (uint_fast8_t row);
-extern uint_fast8_t             zxkbd_row_changed (uint_fast8_t row);
-extern uint_fast8_t             zxkbd_key_state (uint_fast8_t row, uint_fast8_t col);
+extern void                     zxkbd_scan_start (uint_fast16_t row_usec);
+extern uint_fast8_t             zxkbd_calibrate (void);
+extern uint_fast8_t             zxkbd_io (uint_fast8_t row);
+extern uint_fast8_t             zxkbd_idle (void);
+
+#if ZXKBD_SLEEP_MODE != ZXKBD_SLEEP_MODE_NONE
+extern void                     zxkbd_sleep (uint_fast8_t (*busy) (void));
+#endif
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd_bitmap_next () - return index of lowest set bit and clear it, bitmap must not be 0
+ *
+ * Uses count trailing zeros (RBIT + CLZ on Cortex-M3) on both 32 bit halves.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static inline uint_fast8_t
+zxkbd_bitmap_next (zxkbd_bitmap_t * bitmap)
+{
+    uint32_t        lo = (uint32_t) *bitmap;
+    uint_fast8_t    k;
+
+    if (lo)
+    {
+        k = __builtin_ctz (lo);
+    }
+    else
+    {
+        k = 32 + __builtin_ctz ((uint32_t) (*bitmap >> 32));
+    }
+
+    *bitmap &= *bitmap - 1;
+    return k;
+}
 
+#endif
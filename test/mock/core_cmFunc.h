@@ -0,0 +1,57 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * core_cmFunc.h - host replacement of CMSIS core register access
+ *
+ * Replaces cmsis/core_cmFunc.h in host builds, see test/Makefile. A host test runs in one thread and calls
+ * interrupt handlers itself, so PRIMASK is only stored.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef __CORE_CMFUNC_H
+#define __CORE_CMFUNC_H
+
+#include <stdint.h>
+
+extern uint32_t         host_mock_primask;                                      // see host-mock.c
+
+static inline void      __enable_irq (void)             { host_mock_primask = 0; }
+static inline void      __disable_irq (void)            { host_mock_primask = 1; }
+static inline uint32_t  __get_PRIMASK (void)            { return host_mock_primask; }
+static inline void      __set_PRIMASK (uint32_t v)      { host_mock_primask = v; }
+static inline void      __enable_fault_irq (void)       { }
+static inline void      __disable_fault_irq (void)      { }
+static inline uint32_t  __get_BASEPRI (void)            { return 0; }
+static inline void      __set_BASEPRI (uint32_t v)      { (void) v; }
+static inline uint32_t  __get_FAULTMASK (void)          { return 0; }
+static inline void      __set_FAULTMASK (uint32_t v)    { (void) v; }
+static inline uint32_t  __get_CONTROL (void)            { return 0; }
+static inline void      __set_CONTROL (uint32_t v)      { (void) v; }
+static inline uint32_t  __get_IPSR (void)               { return 0; }
+static inline uint32_t  __get_APSR (void)               { return 0; }
+static inline uint32_t  __get_xPSR (void)               { return 0; }
+static inline uint32_t  __get_PSP (void)                { return 0; }
+static inline void      __set_PSP (uint32_t v)          { (void) v; }
+static inline uint32_t  __get_MSP (void)                { return 0; }
+static inline void      __set_MSP (uint32_t v)          { (void) v; }
+
+#endif
@@ -0,0 +1,65 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * core_cmInstr.h - host replacement of CMSIS core instruction access
+ *
+ * Replaces cmsis/core_cmInstr.h in host builds, see test/Makefile. Instructions without effect on the host are
+ * empty, bit operations are done in C.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef __CORE_CMINSTR_H
+#define __CORE_CMINSTR_H
+
+#include <stdint.h>
+
+static inline void      __NOP (void)    { }
+static inline void      __WFI (void)    { }
+static inline void      __WFE (void)    { }
+static inline void      __SEV (void)    { }
+static inline void      __ISB (void)    { __sync_synchronize (); }
+static inline void      __DSB (void)    { __sync_synchronize (); }
+static inline void      __DMB (void)    { __sync_synchronize (); }
+static inline void      __CLREX (void)  { }
+
+static inline uint32_t  __REV (uint32_t v)      { return __builtin_bswap32 (v); }
+static inline uint32_t  __REV16 (uint32_t v)    { return ((v & 0xFF00FF00) >> 8) | ((v & 0x00FF00FF) << 8); }
+static inline int32_t   __REVSH (int32_t v)     { return (int16_t) __builtin_bswap16 ((uint16_t) v); }
+static inline uint32_t  __ROR (uint32_t v, uint32_t n) { n &= 31; return n ? (v >> n) | (v << (32 - n)) : v; }
+static inline uint8_t   __CLZ (uint32_t v)      { return v ? __builtin_clz (v) : 32; }
+
+static inline uint32_t
+__RBIT (uint32_t v)
+{
+    uint32_t    r = 0;
+    int         i;
+
+    for (i = 0; i < 32; i++)
+    {
+        r = (r << 1) | (v & 0x01);
+        v >>= 1;
+    }
+
+    return r;
+}
+
+#endif
@@ -0,0 +1,236 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * host-mock.c - peripheral memory, GPIO and DMA model for host tests
+ *
+ * The firmware sources are compiled unchanged with the real device headers. Their peripheral addresses are made
+ * valid by mapping anonymous memory at the peripheral and system control space, so SPL functions and register
+ * accesses work, but nothing happens by itself: a test calls the model functions below to let GPIO and DMA do
+ * their work, and calls interrupt handlers itself.
+ *
+ * Registers holding addresses are 32 bit (DMA CPAR/CMAR), so tests are linked with -no-pie to keep static
+ * buffers below 4 GB.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "stm32f10x.h"
+#include "host-mock.h"
+
+#define DMA1_CHANNELS           7
+#define DMA_CHANNEL_STRIDE      (DMA1_Channel2_BASE - DMA1_Channel1_BASE)
+
+uint32_t                        SystemCoreClock = 72000000;                     // normally in system_stm32f10x.c
+uint32_t                        host_mock_primask;                              // see mock/core_cmFunc.h
+
+static uint32_t                 dma_count[DMA1_CHANNELS];                       // CNDTR at start of cycle, 0 = not started
+static uint32_t                 dma_pos[DMA1_CHANNELS];                         // transfers done in current cycle
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * host_mock_map () - map memory at fixed address
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+host_mock_map (uint32_t addr, uint32_t len)
+{
+    void *  p = mmap ((void *) (uintptr_t) addr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    if (p != (void *) (uintptr_t) addr)
+    {
+        fprintf (stderr, "host-mock: cannot map 0x%08lx\n", (unsigned long) addr);
+        exit (2);
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * host_mock_init () - map peripheral and system control space, all registers 0
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+host_mock_init (void)
+{
+    uint_fast8_t    i;
+
+    host_mock_map (PERIPH_BASE, 0x00030000);                                    // APB1, APB2, AHB (DMA, RCC, FLASH)
+    host_mock_map (0xE0000000, 0x00100000);                                     // ITM, DWT, SCS (NVIC, SysTick, SCB), DBGMCU
+
+    for (i = 0; i < DMA1_CHANNELS; i++)
+    {
+        dma_count[i] = 0;
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * host_mock_gpio_update () - apply BSRR/BRR writes to ODR, like the port does at once
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+host_mock_gpio_update (GPIO_TypeDef * gpio)
+{
+    uint32_t    bsrr = gpio->BSRR;
+
+    gpio->ODR  |= bsrr & 0xFFFF;                                                // set has priority over reset
+    gpio->ODR  &= ~((bsrr >> 16) & ~bsrr) & 0xFFFF;
+    gpio->ODR  &= ~gpio->BRR;
+    gpio->BSRR  = 0;
+    gpio->BRR   = 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * host_mock_read () - read 8, 16 or 32 bit
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint32_t
+host_mock_read (uint32_t addr, uint_fast8_t size)
+{
+    switch (size)
+    {
+        case 0:     return *(volatile uint8_t *) (uintptr_t) addr;
+        case 1:     return *(volatile uint16_t *) (uintptr_t) addr;
+        default:    return *(volatile uint32_t *) (uintptr_t) addr;
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * host_mock_write () - write 8, 16 or 32 bit
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+host_mock_write (uint32_t addr, uint_fast8_t size, uint32_t value)
+{
+    switch (size)
+    {
+        case 0:     *(volatile uint8_t *) (uintptr_t) addr = value;     break;
+        case 1:     *(volatile uint16_t *) (uintptr_t) addr = value;    break;
+        default:    *(volatile uint32_t *) (uintptr_t) addr = value;    break;
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * host_mock_dma_request () - let a DMA1 channel serve one request, as configured by its CCR, CNDTR, CPAR and CMAR
+ *
+ * Half transfer and transfer complete set the flags in DMA1->ISR. Writes to a GPIO port are applied to ODR.
+ *
+ * Return value: HOST_MOCK_DMA_HT and/or HOST_MOCK_DMA_TC if reached and its interrupt enabled, 0 = none
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+host_mock_dma_request (DMA_Channel_TypeDef * ch)
+{
+    uint_fast8_t    idx     = ((uint32_t) (uintptr_t) ch - DMA1_Channel1_BASE) / DMA_CHANNEL_STRIDE;
+    uint32_t        ccr     = ch->CCR;
+    uint_fast8_t    psize   = (ccr & DMA_CCR1_PSIZE) >> 8;
+    uint_fast8_t    msize   = (ccr & DMA_CCR1_MSIZE) >> 10;
+    uint32_t        paddr   = ch->CPAR;
+    uint32_t        maddr   = ch->CMAR;
+    uint_fast8_t    flags   = 0;
+    uint32_t        value;
+
+    if (! (ccr & DMA_CCR1_EN))
+    {
+        dma_count[idx] = 0;                                                     // CNDTR is taken again when enabled
+        return 0;
+    }
+
+    if (dma_count[idx] == 0 || ch->CNDTR != dma_count[idx] - dma_pos[idx])     // started or CNDTR written by software
+    {
+        dma_count[idx]  = ch->CNDTR;
+        dma_pos[idx]    = 0;
+    }
+
+    if (ccr & DMA_CCR1_PINC)
+    {
+        paddr += dma_pos[idx] << psize;
+    }
+
+    if (ccr & DMA_CCR1_MINC)
+    {
+        maddr += dma_pos[idx] << msize;
+    }
+
+    if (ccr & DMA_CCR1_DIR)                                                     // memory -> peripheral
+    {
+        value = host_mock_read (maddr, msize);
+        host_mock_write (paddr, psize, value);
+
+        if (paddr >= GPIOA_BASE && paddr < GPIOG_BASE + 0x400)
+        {
+            host_mock_gpio_update ((GPIO_TypeDef *) (uintptr_t) (paddr & ~0x3FF));
+        }
+    }
+    else                                                                        // peripheral -> memory
+    {
+        value = host_mock_read (paddr, psize);
+        host_mock_write (maddr, msize, value);
+    }
+
+    dma_pos[idx]++;
+    ch->CNDTR = dma_count[idx] - dma_pos[idx];
+
+    if (dma_pos[idx] == dma_count[idx] / 2)
+    {
+        DMA1->ISR |= (DMA_ISR_GIF1 | DMA_ISR_HTIF1) << (4 * idx);
+
+        if (ccr & DMA_CCR1_HTIE)
+        {
+            flags |= HOST_MOCK_DMA_HT;
+        }
+    }
+
+    if (dma_pos[idx] == dma_count[idx])
+    {
+        DMA1->ISR |= (DMA_ISR_GIF1 | DMA_ISR_TCIF1) << (4 * idx);
+
+        if (ccr & DMA_CCR1_TCIE)
+        {
+            flags |= HOST_MOCK_DMA_TC;
+        }
+
+        dma_pos[idx] = 0;
+
+        if (ccr & DMA_CCR1_CIRC)
+        {
+            ch->CNDTR = dma_count[idx];
+        }
+        else
+        {
+            ch->CCR &= ~DMA_CCR1_EN;
+        }
+    }
+
+    return flags;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * host_mock_dma_irq_done () - apply flags cleared by DMA interrupt handler via DMA1->IFCR
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+host_mock_dma_irq_done (void)
+{
+    DMA1->ISR  &= ~DMA1->IFCR;
+    DMA1->IFCR  = 0;
+}
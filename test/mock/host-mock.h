@@ -0,0 +1,42 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * host-mock.h - peripheral memory, GPIO and DMA model for host tests
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef HOST_MOCK_H
+#define HOST_MOCK_H
+
+#include <stdint.h>
+#include "stm32f10x.h"
+
+/* return flags of host_mock_dma_request() */
+#define HOST_MOCK_DMA_HT        0x01                                            // half transfer reached
+#define HOST_MOCK_DMA_TC        0x02                                            // transfer complete
+
+extern void                     host_mock_init (void);
+extern void                     host_mock_gpio_update (GPIO_TypeDef * gpio);
+extern uint_fast8_t             host_mock_dma_request (DMA_Channel_TypeDef * ch);
+extern void                     host_mock_dma_irq_done (void);
+
+#endif
@@ -0,0 +1,424 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * ps2kbd-dma-test.c - host test of PS/2 DMA transmitter
+ *
+ * Checks the DMA transmitter (PS2KBD_TX_MODE_DMA): every byte 0x00 - 0xFF is queued with ps2kbd_send_code() and
+ * the waveform is played by serving DMA1 channel 7 requests tick by tick. A decoder plays the host side: it samples
+ * the data line on each falling clock edge and checks start bit, data, odd parity and stop bit, that data never
+ * changes while clock is low, that the gap after the stop bit has the configured number of ticks and that both
+ * lines are released at the end. This is done for several inter-byte gaps.
+ *
+ * Host inhibits are checked, too: an inhibit during the frame must abort it and send the byte again, an inhibit
+ * right after the 11th clock, as an 8042 does after each byte, must not. If the host sends a command after aborting
+ * a scancode, the reply must go out before the scancode is sent again. While the host inhibits, the TX queue fills
+ * up: ps2kbd_send_code() must refuse a code instead of waiting, and the queued codes must follow in order.
+ *
+ * Before, the power-on BAT is played the same way with DWT->CYCCNT advanced by one tick per DMA request: it must be
+ * the first byte sent and the transmitter must store its time, see ps2kbd_get_bat_usec(). The init sequence of
+ * main() does not run here, so the time is that of the frame only and is not checked against PS2KBD_BAT_BUDGET_USEC.
+ *
+ * Build and run: cd test && make
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+#include "host-mock.h"
+
+#define PS2KBD_TX_MODE          PS2KBD_TX_MODE_DMA
+#include "../src/ps2kbd/ps2kbd.c"
+
+#define MAX_TICKS               (PS2_DMA_WORDS + 16)                            // timeout per byte
+
+static uint_fast16_t            errors;
+static uint_fast8_t             host_clock_low;                                 // flag: host holds clock low (inhibit)
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * fail () - report error
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+fail (const char * msg, uint_fast8_t ch, uint_fast8_t gap)
+{
+    if (errors < 20)
+    {
+        printf ("ps2kbd-dma-test: byte 0x%02X, gap %u: %s\n", (unsigned) ch, (unsigned) gap, msg);
+    }
+
+    errors++;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * lines_update () - open drain outputs: input = output, clock low if host inhibits
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+lines_update (void)
+{
+    PS2_CLOCK_PORT->IDR = PS2_CLOCK_PORT->ODR & ~(host_clock_low ? PS2_CLOCK_PIN : 0);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * decode () - play a byte already started by the transmitter and decode it like the host
+ *
+ * Return value: 1 = transmitter idle again or next byte started, 0 = stuck, further bytes would wait forever for the queue
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+decode (uint_fast8_t ch, uint_fast8_t gap)
+{
+    uint_fast16_t   frame       = 0;
+    uint_fast8_t    bits        = 0;
+    uint_fast8_t    last_clock  = 1;
+    uint_fast8_t    last_data   = 1;
+    uint_fast8_t    gap_ticks   = 0;
+    uint_fast8_t    done        = 0;
+    uint_fast8_t    tc;
+    uint_fast8_t    stop;
+    uint_fast16_t   tick;
+    uint_fast8_t    clock;
+    uint_fast8_t    data;
+    uint_fast8_t    parity;
+
+    if (ps2kbd_state != PS2_STATE_TX || ! (DMA1_Channel7->CCR & DMA_CCR1_EN) || ! (TIM4->CR1 & TIM_CR1_CEN))
+    {
+        fail ("transfer not started", ch, gap);
+        return 0;
+    }
+
+    for (tick = 0; tick < MAX_TICKS && ! done; tick++)
+    {
+        tc = host_mock_dma_request (DMA1_Channel7) & HOST_MOCK_DMA_TC;          // TIM4 update: next BSRR word
+        DWT->CYCCNT += ps2kbd_tick_usec * (SystemCoreClock / 1000000);
+        lines_update ();
+
+        clock   = ps2kbd_clock_is_low () ? 0 : 1;
+        data    = ps2kbd_data_is_low () ? 0 : 1;
+
+        if (! clock && ! last_clock && data != last_data)
+        {
+            fail ("data changed while clock low", ch, gap);
+        }
+
+        if (! clock && last_clock)                                              // falling edge: host samples data
+        {
+            if (bits < PS2_FRAME_BITS)
+            {
+                frame |= data << bits;
+            }
+
+            bits++;
+        }
+
+        if (bits == PS2_FRAME_BITS && clock && last_clock)
+        {
+            gap_ticks++;
+        }
+
+        last_clock  = clock;
+        last_data   = data;
+
+        if (tc)                                                                 // before stop bit or at end of gap
+        {
+            stop = ps2kbd_dma_stop;
+            DMA1_Channel7_IRQHandler ();
+            host_mock_dma_irq_done ();
+            done = stop || ! (DMA1_Channel7->CCR & DMA_CCR1_EN);
+        }
+    }
+
+    if (! done)
+    {
+        fail ("no transfer complete", ch, gap);
+        return 0;
+    }
+
+    if (bits != PS2_FRAME_BITS)
+    {
+        fail ("wrong number of clock pulses", ch, gap);
+    }
+
+    parity = PS2_PARITY (ch) ^ 0x01;
+
+    if ((frame & 0x01) != 0)
+    {
+        fail ("bad start bit", ch, gap);
+    }
+
+    if (((frame >> 1) & 0xFF) != ch)
+    {
+        fail ("bad data", ch, gap);
+    }
+
+    if (((frame >> 9) & 0x01) != parity || ((__builtin_popcount ((frame >> 1) & 0x1FF)) & 0x01) != 1)
+    {
+        fail ("bad parity", ch, gap);
+    }
+
+    if ((frame >> 10) != 0x01)
+    {
+        fail ("bad stop bit", ch, gap);
+    }
+
+    if (gap_ticks != gap)
+    {
+        fail ("wrong inter-byte gap", ch, gap);
+    }
+
+    if (! last_clock || ! last_data)
+    {
+        fail ("lines not released", ch, gap);
+    }
+
+    if (ps2kbd_state == PS2_STATE_TX && ! ps2kbd_dma_stop && DMA_GetCurrDataCounter (DMA1_Channel7) == PS2_DMA_STOP_WORD)
+    {
+        return 1;                                                               // next byte started at end of gap
+    }
+
+    if (ps2kbd_state != PS2_STATE_IDLE || (DMA1_Channel7->CCR & DMA_CCR1_EN))
+    {
+        fail ("transmitter not idle after byte", ch, gap);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * send_and_decode () - send one byte and decode it like the host, see decode()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+send_and_decode (uint_fast8_t ch, uint_fast8_t gap)
+{
+    ps2kbd_send_code (ch);
+    return decode (ch, gap);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * play_inhibited () - send one byte, host pulls clock low at a falling clock edge and holds it
+ *
+ * edge: number of the falling edge, 1 - 11
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+play_inhibited (uint_fast8_t ch, uint_fast8_t edge)
+{
+    uint_fast8_t    edges       = 0;
+    uint_fast8_t    last_clock  = 1;
+    uint_fast8_t    clock;
+    uint_fast16_t   tick;
+
+    ps2kbd_send_code (ch);
+
+    for (tick = 0; tick < MAX_TICKS && (DMA1_Channel7->CCR & DMA_CCR1_EN); tick++)
+    {
+        if (host_mock_dma_request (DMA1_Channel7) & HOST_MOCK_DMA_TC)
+        {
+            lines_update ();
+            DMA1_Channel7_IRQHandler ();
+            host_mock_dma_irq_done ();
+        }
+
+        lines_update ();
+        clock = (PS2_CLOCK_PORT->ODR & PS2_CLOCK_PIN) ? 1 : 0;                  // clock pulses of device, not host
+
+        if (! clock && last_clock && ++edges == edge)
+        {
+            host_clock_low = 1;
+        }
+
+        last_clock = clock;
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * inhibit () - host inhibits during the frame and after the frame
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+inhibit (void)
+{
+    ps2kbd_stats_t  before;
+    ps2kbd_stats_t  after;
+    uint_fast8_t    n;
+
+    ps2kbd_get_stats (&before);
+    play_inhibited (0x1C, PS2_FRAME_BITS);                                      // after 11th clock: byte is received
+    ps2kbd_get_stats (&after);
+
+    if (after.aborts != before.aborts || ps2kbd_retry_pending || ps2kbd_state != PS2_STATE_IDLE)
+    {
+        fail ("byte sent again after inhibit following the frame", 0x1C, PS2KBD_TX_GAP_TICKS);
+    }
+
+    host_clock_low = 0;
+    lines_update ();
+
+    play_inhibited (0x1C, 5);                                                   // during frame: byte is sent again
+    ps2kbd_get_stats (&after);
+
+    if (after.aborts != before.aborts + 1 || ps2kbd_state != PS2_STATE_INHIBIT)
+    {
+        fail ("frame not aborted by inhibit", 0x1C, PS2KBD_TX_GAP_TICKS);
+        host_clock_low = 0;
+        return;
+    }
+
+    host_clock_low = 0;
+    lines_update ();
+
+    for (n = 0; n < PS2_INHIBIT_RELEASE_TICKS && ps2kbd_state == PS2_STATE_INHIBIT; n++)
+    {
+        TIM4_IRQHandler ();
+    }
+
+    decode (0x1C, PS2KBD_TX_GAP_TICKS);
+
+    play_inhibited (0x32, 5);                                                   // abort, then host sends ECHO
+    ps2kbd_host_command (PS2KBD_CMD_ECHO);
+    host_clock_low = 0;
+    lines_update ();
+
+    for (n = 0; n < PS2_INHIBIT_RELEASE_TICKS && ps2kbd_state == PS2_STATE_INHIBIT; n++)
+    {
+        TIM4_IRQHandler ();
+    }
+
+    if (decode (PS2KBD_REPLY_ECHO, PS2KBD_TX_GAP_TICKS))                        // reply first ...
+    {
+        decode (0x32, PS2KBD_TX_GAP_TICKS);                                     // ... then the aborted scancode
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * queue_full () - host inhibits until TX queue is full, a further code is refused
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+queue_full (void)
+{
+    uint_fast8_t    n;
+
+    host_clock_low = 1;
+    lines_update ();
+
+    for (n = 0; n < PS2KBD_TXBUFLEN; n++)
+    {
+        if (! ps2kbd_send_code (n))
+        {
+            fail ("code refused, queue not full", n, PS2KBD_TX_GAP_TICKS);
+        }
+    }
+
+    if (ps2kbd_send_code (0xFF) || ps2kbd_tx_free () != 0)
+    {
+        fail ("code queued, queue full", 0xFF, PS2KBD_TX_GAP_TICKS);
+    }
+
+    host_clock_low = 0;
+    lines_update ();
+
+    for (n = 0; n < PS2_INHIBIT_RELEASE_TICKS && ps2kbd_state == PS2_STATE_INHIBIT; n++)
+    {
+        TIM4_IRQHandler ();
+    }
+
+    for (n = 0; n < PS2KBD_TXBUFLEN && decode (n, PS2KBD_TX_GAP_TICKS); n++)
+    {
+        ;
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * power_on () - send power-on BAT and check that its time is stored
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+power_on (void)
+{
+    DWT->CYCCNT = 0;                                                            // as after delay_init()
+    ps2kbd_power_on ();
+
+    if (! decode (PS2KBD_REPLY_BAT_OK, PS2KBD_TX_GAP_TICKS))
+    {
+        return;
+    }
+
+    if (ps2kbd_get_bat_usec () == 0)
+    {
+        fail ("BAT time not stored", PS2KBD_REPLY_BAT_OK, PS2KBD_TX_GAP_TICKS);
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * main () - send power-on BAT, then all bytes with several gaps
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+int
+main (void)
+{
+    static const uint8_t    gaps[] = { 0, PS2KBD_TX_GAP_TICKS_MAX_THROUGHPUT, PS2KBD_TX_GAP_TICKS_COMPATIBLE, PS2KBD_TX_GAP_MAX_TICKS };
+    uint_fast8_t            g;
+    uint_fast16_t           ch;
+    uint_fast16_t           bytes = 0;
+
+    host_mock_init ();
+    ps2kbd_init ();
+    PS2_CLOCK_PORT->BSRR = 0;                                                   // CPU writes to BSRR are not modelled,
+    PS2_CLOCK_PORT->ODR |= PS2_CLOCK_PIN | PS2_DATA_PIN;                        // ps2kbd_init() released both lines
+    lines_update ();
+
+    power_on ();
+    inhibit ();
+    queue_full ();
+
+    for (g = 0; g < sizeof (gaps); g++)
+    {
+        if (! ps2kbd_set_timing (PS2KBD_TX_TICK_MIN_USEC, gaps[g]))
+        {
+            fail ("ps2kbd_set_timing() failed", 0, gaps[g]);
+            continue;
+        }
+
+        for (ch = 0; ch < 256 && errors == 0; ch++)
+        {
+            if (! send_and_decode (ch, gaps[g]))
+            {
+                break;
+            }
+
+            bytes++;
+        }
+    }
+
+    if (errors)
+    {
+        printf ("ps2kbd-dma-test: %u errors\n", (unsigned) errors);
+        return 1;
+    }
+
+    printf ("ps2kbd-dma-test: BAT frame %u usec, %u bytes ok\n", (unsigned) ps2kbd_get_bat_usec (), (unsigned) bytes);
+    return 0;
+}
@@ -0,0 +1,288 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------------------
+ * zxkbd-dma-test.c - host test of keyboard DMA scan engine
+ *
+ * Checks the DMA scan engine (ZXKBD_SCAN_MODE_DMA) with a simulated key matrix. Each row slot is played like
+ * the hardware does it: TIM1 update lets DMA1 channel 5 write the next row pattern to the strobe port, TIM1 CC1
+ * lets DMA1 channel 2 capture the sense port after the settle time, and the half transfer and transfer complete
+ * interrupts hand over the frames. The test checks the timer setup, that exactly the expected strobe line is low
+ * in each slot, and that pressing and releasing every key one by one gives exactly one press and one release
+ * event of that key. Two keys pressed at once are checked, too.
+ *
+ * Built twice by the Makefile: rows strobed, and transposed (ZXKBD_STROBE_COLUMNS=1).
+ *
+ * Build and run: cd test && make
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *---------------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+#include "host-mock.h"
+#include "../src/zxkbd/zxkbd.c"
+
+#if ZXKBD_SCAN_MODE != ZXKBD_SCAN_MODE_DMA
+#error ZXKBD_SCAN_MODE_DMA required, see Makefile
+#endif
+
+#if ZXKBD_STROBE_COLUMNS == 1
+#define TEST_NAME               "zxkbd-dma-test (columns)"
+#else
+#define TEST_NAME               "zxkbd-dma-test (rows)"
+#endif
+
+#define ROW_USEC                ZXKBD_SCAN_ROW_USEC
+#define PRESS_FRAMES            3                                               // frames a key is held
+#define RELEASE_FRAMES          (ZXKBD_DEBOUNCE_RELEASE_SAMPLES + 3)            // frames until release must be reported
+
+static zxkbd_bitmap_t           matrix;                                         // simulated keys, bit = ZXKBD_KEY_BIT(key)
+static uint_fast8_t             slot;                                           // strobe line of next row slot
+static uint32_t                 last_usec;                                      // timestamp of last event
+static uint_fast16_t            errors;
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * fail () - report error
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+fail (const char * msg, int key)
+{
+    if (errors < 20)
+    {
+        printf ("%s: key %d: %s\n", TEST_NAME, key, msg);
+    }
+
+    errors++;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * sense_idr () - value of sense port while a strobe line is low: pullups high, pressed keys of the strobe low
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint16_t
+sense_idr (uint_fast8_t strobe)
+{
+    uint16_t        idr = 0xFFFF;
+    uint_fast8_t    n;
+
+#if ZXKBD_STROBE_COLUMNS == 1
+    for (n = 0; n < ZX_KBD_ROWS; n++)                                          // strobe = column, PA0 - PA7 = rows
+    {
+        if (matrix & ZXKBD_KEY_BIT (ZXKBD_KEY_INDEX (n, strobe)))
+        {
+            idr &= ~(1 << n);
+        }
+    }
+#else
+    for (n = 0; n < ZX_KBD_EXT_COLS; n++)                                      // strobe = row, PB3 - PB8 = columns
+    {
+        if (matrix & ZXKBD_KEY_BIT (ZXKBD_KEY_INDEX (strobe, n)))
+        {
+            idr &= ~(1 << (n + 3));
+        }
+    }
+#endif
+    return idr;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * run_slot () - play one row slot of TIM1: update, settle time, CC1, rest of slot
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+run_slot (void)
+{
+    uint_fast8_t    flags;
+    uint32_t        settle = TIM1->CCR1;
+
+    host_mock_dma_request (DMA1_Channel5);                                      // TIM1 update: row pattern -> BSRR
+
+    if ((ZXKBD_STROBE_PORT->ODR & ZXKBD_STROBE_MASK) != (ZXKBD_STROBE_MASK & ~ZXKBD_STROBE_PIN (slot)))
+    {
+        fail ("wrong strobe lines", -1);
+    }
+
+    DWT->CYCCNT += DELAY_USEC_TO_CYCLES (settle);
+    ZXKBD_SENSE_PORT->IDR = sense_idr (slot);
+
+    flags = host_mock_dma_request (DMA1_Channel2);                              // TIM1 CC1: IDR -> capture buffer
+
+    if ((flags != 0) != (slot == ZXKBD_STROBES - 1))
+    {
+        fail ("frame interrupt not after last strobe", -1);
+    }
+
+    if (flags)
+    {
+        DMA1_Channel2_IRQHandler ();
+        host_mock_dma_irq_done ();
+
+        if (DMA1->ISR & (DMA_ISR_HTIF2 | DMA_ISR_TCIF2))
+        {
+            fail ("DMA flags not cleared", -1);
+        }
+    }
+
+    DWT->CYCCNT += DELAY_USEC_TO_CYCLES (ROW_USEC - settle);
+    slot = (slot + 1) % ZXKBD_STROBES;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * run_frames () - play n frames
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+run_frames (uint_fast16_t n)
+{
+    uint_fast8_t    s;
+
+    while (n--)
+    {
+        for (s = 0; s < ZXKBD_STROBES; s++)
+        {
+            run_slot ();
+        }
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * expect_event () - check next event
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+expect_event (uint_fast8_t key, uint_fast8_t state)
+{
+    zxkbd_event_t   ev;
+
+    if (! zxkbd_events_get (&ev))
+    {
+        fail (state == ZXKBD_KEY_PRESSED ? "press missing" : "release missing", key);
+        return;
+    }
+
+    if (ev.key != key || ev.state != state)
+    {
+        fail (state == ZXKBD_KEY_PRESSED ? "wrong event instead of press" : "wrong event instead of release", key);
+    }
+
+    if (ev.usec < last_usec)
+    {
+        fail ("timestamp runs backwards", key);
+    }
+
+    last_usec = ev.usec;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * expect_none () - check that no event is pending
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+expect_none (void)
+{
+    zxkbd_event_t   ev;
+
+    if (zxkbd_events_get (&ev))
+    {
+        fail ("unexpected event", ev.key);
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * main () - press and release all keys
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+int
+main (void)
+{
+    uint_fast8_t    row;
+    uint_fast8_t    col;
+    uint_fast8_t    key;
+    uint_fast8_t    key2;
+    uint_fast16_t   keys = 0;
+
+    host_mock_init ();
+    zxkbd_init ();
+    zxkbd_scan_start (ROW_USEC);
+
+    if (TIM1->ARR != ROW_USEC - 1 || TIM1->PSC != SystemCoreClock / 1000000 - 1)
+    {
+        fail ("wrong TIM1 period", -1);
+    }
+
+    if (TIM1->CCR1 < ZXKBD_SETTLE_USEC || TIM1->CCR1 >= TIM1->ARR)
+    {
+        fail ("compare event outside of row slot", -1);
+    }
+
+    if (! (TIM1->CR1 & TIM_CR1_CEN) || (TIM1->DIER & (TIM_DIER_UDE | TIM_DIER_CC1DE)) != (TIM_DIER_UDE | TIM_DIER_CC1DE))
+    {
+        fail ("TIM1 DMA requests not enabled", -1);
+    }
+
+    run_frames (4);
+    expect_none ();
+
+    for (row = 0; row < ZX_KBD_ROWS; row++)
+    {
+        for (col = 0; col < ZX_KBD_EXT_COLS; col++)
+        {
+            key     = ZXKBD_KEY_INDEX (row, col);
+            matrix  = ZXKBD_KEY_BIT (key);
+            run_frames (PRESS_FRAMES);
+            expect_event (key, ZXKBD_KEY_PRESSED);
+            expect_none ();
+
+            matrix = 0;
+            run_frames (RELEASE_FRAMES);
+            expect_event (key, ZXKBD_KEY_RELEASED);
+            expect_none ();
+            keys++;
+        }
+    }
+
+    key     = ZXKBD_KEY_INDEX (1, 2);                                           // two keys, different rows and columns
+    key2    = ZXKBD_KEY_INDEX (6, 4);
+    matrix  = ZXKBD_KEY_BIT (key);
+    run_frames (PRESS_FRAMES);
+    matrix |= ZXKBD_KEY_BIT (key2);
+    run_frames (PRESS_FRAMES);
+    expect_event (key, ZXKBD_KEY_PRESSED);
+    expect_event (key2, ZXKBD_KEY_PRESSED);
+    matrix = ZXKBD_KEY_BIT (key2);
+    run_frames (RELEASE_FRAMES);
+    expect_event (key, ZXKBD_KEY_RELEASED);
+    matrix = 0;
+    run_frames (RELEASE_FRAMES);
+    expect_event (key2, ZXKBD_KEY_RELEASED);
+    expect_none ();
+
+    if (errors)
+    {
+        printf ("%s: %u errors\n", TEST_NAME, (unsigned) errors);
+        return 1;
+    }
+
+    printf ("%s: %u keys ok\n", TEST_NAME, (unsigned) keys);
+    return 0;
+}